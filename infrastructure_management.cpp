@@ -1,3 +1,7 @@
+// Build: g++ -std=c++20 -O2 -march=native -pthread infrastructure_management.cpp -o infrastructure_management
+// Benchmarks: add -DINFRA_BENCHMARK and -o infrastructure_benchmark (see the end of this file)
+// Tests: add -DINFRA_TEST and -o infrastructure_tests
+
 #include <iostream>
 #include <fstream>
 #include <vector>
@@ -5,11 +9,54 @@
 #include <iomanip>
 #include <algorithm>
 #include <limits>
-#include <sstream>  // For string stream operations
 #include <cstdlib>   // For system("clear") function
+#include <string_view>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <cmath>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <cstdio>     // For rename()
+#include <sys/mman.h> // For mmap() of binary snapshots
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <csignal>
+#include <bit>
+#include <memory>
+#include <array>
+#include <set>
+#include <list>
+#include <tuple>
+#include <mutex>
+#include <condition_variable>
+#include <numeric>
+#include <utility>
+#include <sys/socket.h> // For the query server
+#include <sys/un.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
+// Sizes are narrowed to the int indices used throughout with this check, so a
+// value that does not fit stops the program instead of wrapping
+template <typename To, typename From>
+To checkedCast(From value) {
+    if (!in_range<To>(value)) {
+        cout << "Error: value " << value << " is out of range; stopping." << endl;
+        abort();
+    }
+    return static_cast<To>(value);
+}
+
 // Helper function to print a horizontal line divider
 void printDivider(char symbol = '=', int length = 50) {
     cout << string(length, symbol) << endl;
@@ -17,703 +64,7552 @@ void printDivider(char symbol = '=', int length = 50) {
 
 // Helper function to print a centered title
 void printTitle(const string& title, char symbol = '=', int length = 50) {
-    int padding = (length - title.length()) / 2;
+    int padding = (length - checkedCast<int>(title.length())) / 2;
     cout << string(padding, symbol) << " " << title << " " << string(padding - (title.length() % 2 == 0 ? 0 : 1), symbol) << endl;
 }
 
+// A city's name is a handle into a NameArena (see below), which owns the
+// characters; cities are copied and compared without touching them.
+// A deleted city keeps its slot, marked as a tombstone, until storage is
+// compacted.
 class City {
 private:
     int index;
-    string name;
+    bool deleted;
+    uint16_t region;  // Id of the region (province) it is in; 0 when not set
+    string_view name;
+    double latitude;   // Degrees; NaN when the location is not known
+    double longitude;
 
 public:
-    City(int idx, string n) : index(idx), name(n) {}
+    City(int idx, string_view n, double lat = numeric_limits<double>::quiet_NaN(),
+         double lon = numeric_limits<double>::quiet_NaN())
+        : index(idx), deleted(false), region(0), name(n), latitude(lat), longitude(lon) {}
 
     int getIndex() const { return index; }
-    string getName() const { return name; }
-    void setName(string n) { name = n; }
+    bool isDeleted() const { return deleted; }
+    void markDeleted() { deleted = true; }
+    int getRegion() const { return region; }
+    void setRegion(int r) { region = checkedCast<uint16_t>(r); }
+    string_view getName() const { return name; }
+    void setName(string_view n) { name = n; }
+
+    bool hasLocation() const { return !isnan(latitude); }
+    double getLatitude() const { return latitude; }
+    double getLongitude() const { return longitude; }
+    void setLocation(double lat, double lon) {
+        latitude = lat;
+        longitude = lon;
+    }
 };
 
-class InfrastructureManagement {
+// Hash for city names that also accepts string_view keys, so lookups
+// can be done without building a temporary string
+struct NameHash {
+    using is_transparent = void;
+
+    size_t operator()(string_view name) const {
+        return hash<string_view>{}(name);
+    }
+};
+
+// Append-only store of city names. Each name is copied into large blocks
+// that are never moved or freed, so the string_view handed back stays
+// valid as long as the arena does. City names are unique (the name index
+// rejects duplicates), so there is no separate lookup table here: a live
+// city's handle is the only one for its name, and handles can be compared
+// by address. Names dropped by a rename simply stay behind.
+class NameArena {
 private:
-    vector<City> cities;
-    vector<vector<int>> roadsMatrix;
-    vector<vector<double>> budgetMatrix;
-    bool dataLoaded;
+    static constexpr size_t BLOCK_SIZE = 256 * 1024;
 
-    // Helper functions
-    int findCityIndexByName(const string& cityName) {
-        for (size_t i = 0; i < cities.size(); i++) {
-            if (cities[i].getName() == cityName) {
-                return i;
-            }
-        }
-        return -1;
+    vector<unique_ptr<char[]>> blocks;
+    char* next;   // Free space in the newest block
+    size_t left;
+    size_t bytes;
+
+    void addBlock(size_t size) {
+        size_t blockSize = max(BLOCK_SIZE, size);
+        blocks.push_back(make_unique_for_overwrite<char[]>(blockSize));
+        next = blocks.back().get();
+        left = blockSize;
     }
 
-    int findCityIndexByIndex(int index) {
-        for (size_t i = 0; i < cities.size(); i++) {
-            if (cities[i].getIndex() == index) {
-                return i;
-            }
+public:
+    NameArena() : next(nullptr), left(0), bytes(0) {}
+    NameArena(const NameArena&) = delete;
+    NameArena& operator=(const NameArena&) = delete;
+
+    // Copies 'name' in and returns the arena's copy
+    string_view store(string_view name) {
+        if (name.size() > left) {
+            addBlock(name.size());
         }
-        return -1;
+        memcpy(next, name.data(), name.size());
+        string_view stored(next, name.size());
+        next += name.size();
+        left -= name.size();
+        bytes += name.size();
+        return stored;
     }
 
-    void resizeMatrices() {
-        size_t n = cities.size();
-        
-        // Resize roads matrix
-        roadsMatrix.resize(n);
-        for (size_t i = 0; i < n; i++) {
-            roadsMatrix[i].resize(n, 0);
+    // Makes room for 'size' more bytes of names, so that bulk loads fill
+    // one block
+    void reserve(size_t size) {
+        if (size > left) {
+            addBlock(size);
         }
-        
-        // Resize budget matrix
-        budgetMatrix.resize(n);
-        for (size_t i = 0; i < n; i++) {
-            budgetMatrix[i].resize(n, 0.0);
+    }
+
+    size_t byteCount() const { return bytes; }
+};
+
+// A road as seen from one of its endpoints: the city at the other end,
+// the road's length in km (0 when not recorded; it fits in what would
+// otherwise be padding) and the budget assigned to the road (0 until a
+// budget is added)
+struct Road {
+    int neighbor;
+    float length;
+    double budget;
+};
+
+// A road listed once with both of its endpoints
+struct RoadEdge {
+    int city1;
+    int city2;
+    double budget;
+    float length = 0.0f;
+};
+
+// Sparse road network. Every city keeps its own list of roads sorted by
+// neighbor, so memory grows with the number of roads instead of the
+// square of the number of cities, and walking the neighbors of a city
+// only touches roads that actually exist.
+class RoadGraph {
+private:
+    vector<vector<Road>> adjacency;
+    size_t roadCount;
+
+    static bool neighborLess(const Road& road, int neighbor) {
+        return road.neighbor < neighbor;
+    }
+
+    // Position where the road from -> to is (or would be) stored
+    vector<Road>::iterator locate(int from, int to) {
+        vector<Road>& list = adjacency[from];
+        return lower_bound(list.begin(), list.end(), to, neighborLess);
+    }
+
+    vector<Road>::const_iterator locate(int from, int to) const {
+        const vector<Road>& list = adjacency[from];
+        return lower_bound(list.begin(), list.end(), to, neighborLess);
+    }
+
+    const Road* findRoad(int from, int to) const {
+        auto it = locate(from, to);
+        if (it == adjacency[from].end() || it->neighbor != to) {
+            return nullptr;
         }
+        return &*it;
+    }
+
+    void insertHalf(int from, int to) {
+        auto it = locate(from, to);
+        adjacency[from].insert(it, Road{to, 0.0f, 0.0});
+    }
+
+    void setHalfBudget(int from, int to, double budget) {
+        auto it = locate(from, to);
+        it->budget = budget;
+    }
+
+    void setHalfLength(int from, int to, float length) {
+        auto it = locate(from, to);
+        it->length = length;
     }
 
 public:
-    InfrastructureManagement() : dataLoaded(false) {
-        // Try to load data from files on initialization
-        loadDataFromFiles();
+    RoadGraph() : roadCount(0) {}
+
+    size_t getCityCount() const { return adjacency.size(); }
+    size_t getRoadCount() const { return roadCount; }
+
+    void clear() {
+        adjacency.clear();
+        roadCount = 0;
     }
 
-    void addCity(string name) {
-        // Check if city already exists
-        if (findCityIndexByName(name) != -1) {
-            cout << "City '" << name << "' already exists!" << endl;
-            return;
-        }
-        
-        // Assign the next available index
-        int nextIndex = cities.empty() ? 1 : cities.back().getIndex() + 1;
-        cities.push_back(City(nextIndex, name));
-        
-        // Resize matrices to accommodate the new city
-        resizeMatrices();
-        
-        cout << "City '" << name << "' added with index " << nextIndex << endl;
+    // Make room for cities up to (but not including) slot n
+    void resize(size_t n) {
+        adjacency.resize(n);
     }
 
-    void addRoad(string city1, string city2) {
-        int idx1 = findCityIndexByName(city1);
-        int idx2 = findCityIndexByName(city2);
-        
-        if (idx1 == -1) {
-            cout << "City '" << city1 << "' does not exist!" << endl;
-            return;
-        }
-        
-        if (idx2 == -1) {
-            cout << "City '" << city2 << "' does not exist!" << endl;
-            return;
-        }
-        
-        if (idx1 == idx2) {
-            cout << "Cannot add a road between the same city!" << endl;
-            return;
-        }
-        
-        // Add road in both directions (undirected graph)
-        roadsMatrix[idx1][idx2] = 1;
-        roadsMatrix[idx2][idx1] = 1;
-        
-        cout << "Road added between " << city1 << " and " << city2 << endl;
+    void reserve(size_t n) {
+        adjacency.reserve(n);
     }
 
-    void addBudget(string city1, string city2, double budget) {
-        int idx1 = findCityIndexByName(city1);
-        int idx2 = findCityIndexByName(city2);
-        
-        if (idx1 == -1) {
-            cout << "City '" << city1 << "' does not exist!" << endl;
-            return;
-        }
-        
-        if (idx2 == -1) {
-            cout << "City '" << city2 << "' does not exist!" << endl;
-            return;
-        }
-        
-        if (roadsMatrix[idx1][idx2] != 1) {
-            cout << "No road exists between " << city1 << " and " << city2 << "!" << endl;
-            cout << "Please add a road first before assigning a budget." << endl;
-            return;
-        }
-        
-        // Add budget in both directions (undirected graph)
-        budgetMatrix[idx1][idx2] = budget;
-        budgetMatrix[idx2][idx1] = budget;
-        
-        cout << "Budget added for the road between " << city1 << " and " << city2 << endl;
+    bool hasRoad(int a, int b) const {
+        return findRoad(a, b) != nullptr;
     }
 
-    void editCity(int index, string newName) {
-        int idx = findCityIndexByIndex(index);
-        
-        if (idx == -1) {
-            cout << "No city found with index " << index << endl;
-            return;
-        }
-        
-        // Check if the new name already exists
-        int existingIdx = findCityIndexByName(newName);
-        if (existingIdx != -1 && existingIdx != idx) {
-            cout << "City '" << newName << "' already exists!" << endl;
-            return;
-        }
-        
-        cities[idx].setName(newName);
-        cout << "City updated successfully" << endl;
+    // Budget of the road between a and b, or 0 when there is no road
+    double getBudget(int a, int b) const {
+        const Road* road = findRoad(a, b);
+        return road ? road->budget : 0.0;
     }
 
-    void searchCity(int index) {
-        int idx = findCityIndexByIndex(index);
-        
-        printDivider('=', 60);
-        printTitle("SEARCH RESULTS", '=', 60);
-        printDivider('-', 60);
-        
-        if (idx == -1) {
-            cout << "No city found with index " << index << endl;
-            printDivider('-', 60);
-            return;
+    // Adds an undirected road. Returns false if the road was already there,
+    // in which case its budget is left untouched.
+    bool addRoad(int a, int b) {
+        if (hasRoad(a, b)) {
+            return false;
         }
-        
-        cout << setw(10) << "INDEX" << setw(30) << "CITY NAME" << endl;
-        printDivider('-', 60);
-        cout << setw(10) << cities[idx].getIndex() << setw(30) << cities[idx].getName() << endl;
-        printDivider('=', 60);
+        insertHalf(a, b);
+        insertHalf(b, a);
+        roadCount++;
+        return true;
     }
 
-    void displayCities() {
-        printDivider('=', 60);
-        printTitle("CITIES LIST", '=', 60);
-        printDivider('-', 60);
-        
-        cout << setw(10) << "INDEX" << setw(30) << "CITY NAME" << endl;
-        printDivider('-', 60);
-        
-        for (const auto& city : cities) {
-            cout << setw(10) << city.getIndex() << setw(30) << city.getName() << endl;
+    // Removes an undirected road. Returns false if there was none.
+    bool removeRoad(int a, int b) {
+        auto it = locate(a, b);
+        if (it == adjacency[a].end() || it->neighbor != b) {
+            return false;
         }
-        
-        printDivider('=', 60);
+        adjacency[a].erase(it);
+        adjacency[b].erase(locate(b, a));
+        roadCount--;
+        return true;
     }
 
-    void displayRoads() {
-        displayCities();
-        
-        printDivider('=', 60);
-        printTitle("ROADS ADJACENCY MATRIX", '=', 60);
-        printDivider('-', 60);
-        
-        // Display column headers (city indices)
-        cout << setw(6) << " ";
-        for (size_t j = 0; j < cities.size(); j++) {
-            cout << setw(4) << cities[j].getIndex();
-        }
-        cout << endl;
-        
-        printDivider('-', 60);
-        
-        // Display matrix with row headers
-        for (size_t i = 0; i < cities.size(); i++) {
-            cout << setw(4) << cities[i].getIndex() << " |";
-            for (size_t j = 0; j < cities.size(); j++) {
-                cout << setw(4) << roadsMatrix[i][j];
+    // Drops the cities whose entry in newSlot is -1 (they must have no roads
+    // left) and moves the rest to their new slots. The new slots must keep
+    // the cities in the same order, so every road list stays sorted.
+    void renumber(const vector<int>& newSlot, size_t remaining) {
+        for (size_t i = 0; i < adjacency.size(); i++) {
+            if (newSlot[i] == -1) {
+                continue;
+            }
+            for (Road& road : adjacency[i]) {
+                road.neighbor = newSlot[road.neighbor];
+            }
+            if (newSlot[i] != (int)i) {
+                adjacency[newSlot[i]] = move(adjacency[i]);
             }
-            cout << endl;
         }
-        
-        printDivider('=', 60);
+        adjacency.resize(remaining);
     }
 
-    void displayAllData() {
-        displayCities();
-        
-        // Display Roads Adjacency Matrix
-        printDivider('=', 60);
-        printTitle("ROADS ADJACENCY MATRIX", '=', 60);
-        printDivider('-', 60);
-        
-        // Display column headers (city indices)
-        cout << setw(6) << " ";
-        for (size_t j = 0; j < cities.size(); j++) {
-            cout << setw(4) << cities[j].getIndex();
+    // Sets the budget in both directions. The road must already exist.
+    void setBudget(int a, int b, double budget) {
+        setHalfBudget(a, b, budget);
+        setHalfBudget(b, a, budget);
+    }
+
+    // Length of the road between a and b in km, or 0 when not recorded
+    float getLength(int a, int b) const {
+        const Road* road = findRoad(a, b);
+        return road ? road->length : 0.0f;
+    }
+
+    // Sets the length in both directions. The road must already exist.
+    void setLength(int a, int b, float length) {
+        setHalfLength(a, b, length);
+        setHalfLength(b, a, length);
+    }
+
+    // Roads leaving a city, sorted by neighbor
+    const vector<Road>& neighbors(size_t city) const {
+        return adjacency[city];
+    }
+
+    // Adds many roads at once, e.g. while loading a file. The result is the
+    // same as calling addRoad and setBudget for each one in order (the last
+    // budget given for a road wins), but each city's list is sorted once
+    // instead of shifting elements on every insert.
+    void addRoads(const vector<RoadEdge>& edges) {
+        vector<uint32_t> extra(adjacency.size(), 0);
+        for (const RoadEdge& edge : edges) {
+            extra[edge.city1]++;
+            extra[edge.city2]++;
         }
-        cout << endl;
-        
-        printDivider('-', 60);
-        
-        // Display matrix with row headers
-        for (size_t i = 0; i < cities.size(); i++) {
-            cout << setw(4) << cities[i].getIndex() << " |";
-            for (size_t j = 0; j < cities.size(); j++) {
-                cout << setw(4) << roadsMatrix[i][j];
+        for (size_t i = 0; i < adjacency.size(); i++) {
+            if (extra[i] > 0) {
+                adjacency[i].reserve(adjacency[i].size() + extra[i]);
             }
-            cout << endl;
         }
-        
-        printDivider('=', 60);
-        
-        // Display Budgets Adjacency Matrix
-        printTitle("BUDGETS ADJACENCY MATRIX (Billion RWF)", '=', 60);
-        printDivider('-', 60);
-        
-        // Display column headers (city indices)
-        cout << setw(6) << " ";
-        for (size_t j = 0; j < cities.size(); j++) {
-            cout << setw(7) << cities[j].getIndex();
+        for (const RoadEdge& edge : edges) {
+            adjacency[edge.city1].push_back(Road{edge.city2, edge.length, edge.budget});
+            adjacency[edge.city2].push_back(Road{edge.city1, edge.length, edge.budget});
         }
-        cout << endl;
-        
-        printDivider('-', 60);
-        
-        // Display matrix with row headers
-        for (size_t i = 0; i < cities.size(); i++) {
-            cout << setw(4) << cities[i].getIndex() << " |";
-            for (size_t j = 0; j < cities.size(); j++) {
-                cout << fixed << setprecision(1) << setw(7) << budgetMatrix[i][j];
+
+        roadCount = 0;
+        for (size_t i = 0; i < adjacency.size(); i++) {
+            vector<Road>& list = adjacency[i];
+            if (extra[i] > 0) {
+                stable_sort(list.begin(), list.end(), [](const Road& a, const Road& b) {
+                    return a.neighbor < b.neighbor;
+                });
+                // Keep one entry per neighbor, carrying the budget and length
+                // added last
+                size_t kept = 0;
+                for (size_t j = 0; j < list.size(); j++) {
+                    if (kept > 0 && list[kept - 1].neighbor == list[j].neighbor) {
+                        list[kept - 1] = list[j];
+                    } else {
+                        list[kept++] = list[j];
+                    }
+                }
+                list.resize(kept);
             }
-            cout << endl;
+            roadCount += list.size();
         }
-        
-        printDivider('=', 60);
+        roadCount /= 2;
     }
 
-    void saveCitiesToFile() {
-        ofstream file("cities.txt");
-        
-        if (!file.is_open()) {
-            cout << "Error opening cities.txt for writing!" << endl;
-            return;
-        }
-        
-        file << "Index\tCity_name" << endl;
-        for (const auto& city : cities) {
-            file << city.getIndex() << "\t" << city.getName() << endl;
+    // Replaces the whole graph with roads given in compressed sparse row
+    // form: the roads of city i are edges[offsets[i]] .. edges[offsets[i + 1] - 1],
+    // already sorted by neighbor. Each list is copied in one block.
+    void assign(size_t cityCount, const uint64_t* offsets, const Road* edges) {
+        adjacency.resize(cityCount);
+        for (size_t i = 0; i < cityCount; i++) {
+            adjacency[i].assign(edges + offsets[i], edges + offsets[i + 1]);
         }
-        
-        file.close();
-        cout << "Cities saved to cities.txt" << endl;
+        roadCount = offsets[cityCount] / 2;
     }
 
-    void saveRoadsToFile() {
-        ofstream file("roads.txt");
-        
-        if (!file.is_open()) {
-            cout << "Error opening roads.txt for writing!" << endl;
-            return;
-        }
-        
-        file << "Nbr\tRoad\t\t\tBudget" << endl;
-        
-        int roadCount = 0;
-        for (size_t i = 0; i < cities.size(); i++) {
-            for (size_t j = i + 1; j < cities.size(); j++) {
-                if (roadsMatrix[i][j] == 1) {
-                    roadCount++;
-                    file << roadCount << ".\t" 
-                         << cities[i].getName() << "-" << cities[j].getName() 
-                         << "\t\t" << fixed << setprecision(2) << budgetMatrix[i][j] << endl;
+    // Every road once, listed from its lower-numbered endpoint
+    vector<RoadEdge> edgeList() const {
+        vector<RoadEdge> edges;
+        edges.reserve(roadCount);
+        for (size_t i = 0; i < adjacency.size(); i++) {
+            for (const Road& road : adjacency[i]) {
+                if (road.neighbor > (int)i) {
+                    edges.push_back(RoadEdge{(int)i, road.neighbor, road.budget, road.length});
                 }
             }
         }
-        
-        file.close();
-        cout << "Roads saved to roads.txt" << endl;
+        return edges;
     }
-    
-    void loadCitiesFromFile() {
-        ifstream file("cities.txt");
-        
-        if (!file.is_open()) {
-            cout << "No previous cities data found." << endl;
-            return;
-        }
-        
-        string line;
-        // Skip header line
-        getline(file, line);
-        
-        cities.clear(); // Clear existing cities
-        
-        while (getline(file, line)) {
-            stringstream ss(line);
-            int index;
-            string name;
-            
-            ss >> index;
-            // Skip the tab character
-            ss.ignore(1);
-            // Read the rest of the line as the city name
-            getline(ss, name);
-            
-            cities.push_back(City(index, name));
+};
+
+// Number of bits set in a[i] & b[i] over 'words' 64-bit words. Both arrays
+// must be 32-byte aligned and 'words' a multiple of 8 (one cache line).
+// With AVX2 the bits are counted 256 at a time using the nibble lookup
+// method; otherwise one word at a time with the popcount instruction.
+inline size_t countCommonBits(const uint64_t* a, const uint64_t* b, size_t words) {
+#ifdef __AVX2__
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowNibble = _mm256_set1_epi8(0x0f);
+    __m256i total = _mm256_setzero_si256();
+    for (size_t i = 0; i < words; i += 4) {
+        __m256i both = _mm256_and_si256(_mm256_load_si256((const __m256i*)(a + i)),
+                                        _mm256_load_si256((const __m256i*)(b + i)));
+        __m256i low = _mm256_shuffle_epi8(lookup, _mm256_and_si256(both, lowNibble));
+        __m256i high = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(both, 4), lowNibble));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_add_epi8(low, high), _mm256_setzero_si256()));
+    }
+    return _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+           _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+#else
+    size_t count = 0;
+    for (size_t i = 0; i < words; i++) {
+        count += popcount(a[i] & b[i]);
+    }
+    return count;
+#endif
+}
+
+// Dense road existence matrix using one bit per pair of cities, 32 times
+// smaller than an int matrix. Each row starts on a 64-byte boundary and is
+// padded to whole cache lines, so row operations (degree, shared
+// neighbors) run a word or a vector at a time with no edge cases.
+class RoadBitMatrix {
+private:
+    struct FreeBits {
+        void operator()(uint64_t* bits) const { free(bits); }
+    };
+
+    unique_ptr<uint64_t, FreeBits> bits;
+    size_t cityCount;
+    size_t capacity;     // Cities that fit before the matrix must grow
+    size_t wordsPerRow;
+
+    static size_t wordsFor(size_t cities) {
+        size_t words = (cities + 63) / 64;
+        return (words + 7) / 8 * 8;
+    }
+
+    uint64_t* row(size_t city) { return bits.get() + city * wordsPerRow; }
+    const uint64_t* row(size_t city) const { return bits.get() + city * wordsPerRow; }
+
+    // Reallocates for 'newCapacity' cities, keeping the existing bits
+    void grow(size_t newCapacity) {
+        size_t newWords = wordsFor(newCapacity);
+        size_t bytes = newCapacity * newWords * sizeof(uint64_t);
+        uint64_t* fresh = (uint64_t*)aligned_alloc(64, max(bytes, size_t(64)));
+        if (fresh == nullptr) {
+            throw bad_alloc();
         }
-        
-        file.close();
-        
-        // Resize matrices to match loaded cities
-        if (!cities.empty()) {
-            resizeMatrices();
-            cout << cities.size() << " cities loaded from cities.txt" << endl;
+        memset(fresh, 0, bytes);
+        for (size_t i = 0; i < cityCount; i++) {
+            memcpy(fresh + i * newWords, row(i), wordsPerRow * sizeof(uint64_t));
         }
+        bits.reset(fresh);
+        capacity = newCapacity;
+        wordsPerRow = newWords;
     }
-    
-    void loadRoadsFromFile() {
-        ifstream file("roads.txt");
-        
-        if (!file.is_open()) {
-            cout << "No previous roads data found." << endl;
-            return;
-        }
-        
-        string line;
-        // Skip header line
-        getline(file, line);
-        
-        while (getline(file, line)) {
-            stringstream ss(line);
-            int roadNum;
-            string roadInfo;
-            double budget;
-            string city1, city2;
-            
-            // Read road number (with the dot)
-            ss >> roadNum;
-            ss.ignore(2); // Skip the dot and tab
-            
-            // Read the road info (city1-city2)
-            getline(ss, roadInfo, '\t');
-            
-            // Find the position of the hyphen
-            size_t hyphenPos = roadInfo.find('-');
-            if (hyphenPos != string::npos) {
-                city1 = roadInfo.substr(0, hyphenPos);
-                city2 = roadInfo.substr(hyphenPos + 1);
-                
-                // Skip tabs
-                ss >> budget;
-                
-                // Add the road and budget
-                int idx1 = findCityIndexByName(city1);
-                int idx2 = findCityIndexByName(city2);
-                
-                if (idx1 != -1 && idx2 != -1) {
-                    roadsMatrix[idx1][idx2] = 1;
-                    roadsMatrix[idx2][idx1] = 1;
-                    budgetMatrix[idx1][idx2] = budget;
-                    budgetMatrix[idx2][idx1] = budget;
+
+public:
+    RoadBitMatrix() : cityCount(0), capacity(0), wordsPerRow(0) {}
+
+    RoadBitMatrix(const RoadBitMatrix& other) : cityCount(0), capacity(0), wordsPerRow(0) {
+        *this = other;
+    }
+
+    RoadBitMatrix& operator=(const RoadBitMatrix& other) {
+        if (this != &other) {
+            bits.reset();
+            cityCount = capacity = wordsPerRow = 0;
+            if (other.cityCount > 0) {
+                grow(other.cityCount);
+                for (size_t i = 0; i < other.cityCount; i++) {
+                    memcpy(row(i), other.row(i), min(wordsPerRow, other.wordsPerRow) * sizeof(uint64_t));
                 }
+                cityCount = other.cityCount;
             }
         }
-        
-        file.close();
-        cout << "Roads and budgets loaded from roads.txt" << endl;
+        return *this;
     }
-    
-    void loadDataFromFiles() {
-        loadCitiesFromFile();
-        loadRoadsFromFile();
-        dataLoaded = true;
+
+    size_t getCityCount() const { return cityCount; }
+
+    // Approximate memory used by the matrix
+    size_t bytesUsed() const { return capacity * wordsPerRow * sizeof(uint64_t); }
+
+    void build(const RoadGraph& graph) {
+        bits.reset();
+        cityCount = capacity = wordsPerRow = 0;
+        size_t n = graph.getCityCount();
+        if (n > 0) {
+            grow(n);
+        }
+        cityCount = n;
+        for (size_t i = 0; i < n; i++) {
+            for (const Road& road : graph.neighbors(i)) {
+                set(checkedCast<int>(i), road.neighbor);
+            }
+        }
+    }
+
+    // Capacity doubles as cities are added, but never past 'maxCities'
+    void addCity(size_t maxCities) {
+        if (cityCount == capacity) {
+            grow(max(cityCount + 1, min(capacity * 2, maxCities)));
+        }
+        cityCount++;
+    }
+
+    void set(int a, int b) {
+        row(a)[b / 64] |= uint64_t(1) << (b % 64);
+    }
+
+    void unset(int a, int b) {
+        row(a)[b / 64] &= ~(uint64_t(1) << (b % 64));
+    }
+
+    bool test(int a, int b) const {
+        return (row(a)[b / 64] >> (b % 64)) & 1;
+    }
+
+    size_t degree(int city) const {
+        return countCommonBits(row(city), row(city), wordsPerRow);
     }
 
-    void saveAllData() {
-        saveCitiesToFile();
-        saveRoadsToFile();
+    size_t countCommonNeighbors(int a, int b) const {
+        return countCommonBits(row(a), row(b), wordsPerRow);
+    }
+
+    // Cities with a road to both a and b, in slot order
+    void commonNeighbors(int a, int b, vector<int>& result) const {
+        result.clear();
+        const uint64_t* rowA = row(a);
+        const uint64_t* rowB = row(b);
+        for (size_t w = 0; w < wordsPerRow; w++) {
+            uint64_t both = rowA[w] & rowB[w];
+            while (both != 0) {
+                result.push_back(checkedCast<int>(w * 64 + countr_zero(both)));
+                both &= both - 1;
+            }
+        }
     }
 };
 
+// What a route search minimizes: the total road budget, or the total
+// length in km
+enum class RouteMetric { Budget, Length };
 
+const double EARTH_RADIUS_KM = 6371.0;
 
-void displayMenu() {
-    system("clear"); // Clear the console on Linux/macOS
-    
-    printDivider('=', 60);
-    printTitle("RWANDA INFRASTRUCTURE MANAGEMENT SYSTEM", '=', 60);
-    printDivider('=', 60);
-    
-    cout << "\n" << setw(25) << "MAIN MENU" << "\n" << endl;
-    printDivider('-', 60);
-    
-    cout << "  1. Add new city(ies)" << endl;
-    cout << "  2. Add roads between cities" << endl;
-    cout << "  3. Add the budget for roads" << endl;
-    cout << "  4. Edit city" << endl;
-    cout << "  5. Search for a city using its index" << endl;
-    cout << "  6. Display cities" << endl;
-    cout << "  7. Display roads" << endl;
-    cout << "  8. Display recorded data on console" << endl;
-    cout << "  9. Exit" << endl;
-    
-    printDivider('-', 60);
-    cout << "Enter your choice: ";
-}
+// City positions on the globe and what they say about route costs. For A*
+// the planner needs an estimate that never exceeds the real cost from a
+// city to the target: the straight-line distance times the lowest cost per
+// km of any road. That rate is only meaningful when every city has a
+// location, so with any city missing one the estimates are zero and
+// routing is plain Dijkstra.
+class RouteGeometry {
+private:
+    vector<array<double, 3>> points;  // Unit vectors; NaN without a location
+    double budgetRate;  // Lowest budget per km of surface distance over all roads
+    double lengthRate;  // Lowest length per km of surface distance over all roads
 
-int main() {
-    // Display welcome message
-    system("clear");
-    printDivider('*', 70);
-    printTitle("WELCOME TO RWANDA INFRASTRUCTURE MANAGEMENT SYSTEM", '*', 70);
-    printTitle("Ministry of Infrastructure", '-', 70);
-    printDivider('*', 70);
-    cout << "\nThis system helps manage cities, roads, and budgets for Rwanda's infrastructure." << endl;
-    cout << "Press Enter to continue..." << endl;
-    cin.get();
-    
-    InfrastructureManagement infra;
-    int choice;
-    
-    do {
-        displayMenu();
-        
-        // Check if the input is a valid integer
-        if (!(cin >> choice)) {
-            // Clear the error state
-            cin.clear();
-            // Discard invalid input
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-            cout << "Invalid input. Please enter a number." << endl;
-            continue;
+public:
+    RouteGeometry() : budgetRate(0.0), lengthRate(0.0) {}
+
+    void build(const vector<City>& cities, const RoadGraph& graph) {
+        const double nan = numeric_limits<double>::quiet_NaN();
+        const double radians = M_PI / 180.0;
+        points.assign(cities.size(), {nan, nan, nan});
+        bool complete = true;
+        for (size_t i = 0; i < cities.size(); i++) {
+            if (!cities[i].hasLocation()) {
+                complete = false;
+                continue;
+            }
+            double lat = cities[i].getLatitude() * radians;
+            double lon = cities[i].getLongitude() * radians;
+            points[i] = {cos(lat) * cos(lon), cos(lat) * sin(lon), sin(lat)};
         }
-        
-        // Clear the input buffer
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        
-        switch (choice) {
-            case 1: {
-                printDivider('=', 60);
-                printTitle("ADD NEW CITIES", '=', 60);
-                printDivider('-', 60);
-                int numCities;
-                cout << "Enter the number of cities to add: ";
-                
-                // Check if the input is a valid integer
-                if (!(cin >> numCities)) {
-                    // Clear the error state
-                    cin.clear();
-                    // Discard invalid input
-                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                    cout << "Invalid input. Please enter a number." << endl;
-                    break;
-                }
-                
-                // Validate the number of cities
-                if (numCities <= 0) {
-                    cout << "Please enter a positive number of cities." << endl;
-                    break;
-                }
-                
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                
-                for (int i = 0; i < numCities; i++) {
-                    string cityName;
-                    cout << "Enter name for city " << (i + 1) << ": ";
-                    getline(cin, cityName);
-                    infra.addCity(cityName);
+
+        budgetRate = lengthRate = numeric_limits<double>::infinity();
+        for (size_t i = 0; complete && i < cities.size(); i++) {
+            for (const Road& road : graph.neighbors(i)) {
+                double km = surfaceKm(checkedCast<int>(i), road.neighbor);
+                if (road.neighbor < (int)i || km <= 0.0) {
+                    continue;
                 }
-                
-                // Save data after adding cities
-                infra.saveAllData();
-                cout << "\nPress Enter to continue..." << endl;
-                cin.get();
+                budgetRate = min(budgetRate, road.budget / km);
+                lengthRate = min(lengthRate, roadLength(checkedCast<int>(i), road) / km);
+            }
+        }
+        // Shave off a little so rounding can never push an estimate above
+        // the real cost; no roads (or no locations) means no estimate
+        budgetRate = complete && isfinite(budgetRate) ? max(0.0, budgetRate * (1.0 - 1e-9)) : 0.0;
+        lengthRate = complete && isfinite(lengthRate) ? max(0.0, lengthRate * (1.0 - 1e-9)) : 0.0;
+    }
+
+    bool located(int slot) const { return !isnan(points[slot][0]); }
+
+    // Straight line through the earth between two cities, in km. Never
+    // longer than the distance along the surface, and cheap to compute.
+    double chordKm(int a, int b) const {
+        double dx = points[a][0] - points[b][0];
+        double dy = points[a][1] - points[b][1];
+        double dz = points[a][2] - points[b][2];
+        return EARTH_RADIUS_KM * sqrt(dx * dx + dy * dy + dz * dz);
+    }
+
+    // Great-circle distance between two cities, in km
+    double surfaceKm(int a, int b) const {
+        return 2.0 * EARTH_RADIUS_KM * asin(min(1.0, chordKm(a, b) / (2.0 * EARTH_RADIUS_KM)));
+    }
+
+    // Length of a road in km: as recorded, or else the great-circle distance
+    // between its cities. NaN when neither is known.
+    double roadLength(int from, const Road& road) const {
+        if (road.length > 0.0f) {
+            return road.length;
+        }
+        if (located(from) && located(road.neighbor)) {
+            return surfaceKm(from, road.neighbor);
+        }
+        return numeric_limits<double>::quiet_NaN();
+    }
+
+    // Lower bound on the cost of any route from 'from' to 'target'
+    double estimate(RouteMetric metric, int from, int target) const {
+        double rate = metric == RouteMetric::Budget ? budgetRate : lengthRate;
+        return rate > 0.0 ? rate * chordKm(from, target) : 0.0;
+    }
+};
+
+// Min-heap keyed by cost with four children per node. It is shallower than
+// a binary heap and the children of a node sit next to each other in
+// memory, so sift-down touches fewer cache lines on large graphs.
+class QuadHeap {
+public:
+    struct Entry {
+        double key;
+        int node;
+    };
+
+private:
+    vector<Entry> entries;
+
+public:
+    bool empty() const { return entries.empty(); }
+
+    // Smallest entry, without removing it; the heap must not be empty
+    const Entry& top() const { return entries.front(); }
+
+    // Empties the heap but keeps its storage for the next query
+    void clear() { entries.clear(); }
+
+    void push(double key, int node) {
+        size_t pos = entries.size();
+        entries.push_back(Entry{key, node});
+        while (pos > 0) {
+            size_t parent = (pos - 1) / 4;
+            if (entries[parent].key <= key) {
                 break;
             }
-            
-            case 2: {
-                printDivider('=', 60);
-                printTitle("ADD ROADS BETWEEN CITIES", '=', 60);
-                printDivider('-', 60);
-                string city1, city2;
-                cout << "Enter the name of the first city: ";
-                getline(cin, city1);
-                if (city1.empty()) {
-                    cout << "City name cannot be empty. Please try again." << endl;
-                    break;
-                }
-                
-                cout << "Enter the name of the second city: ";
-                getline(cin, city2);
-                if (city2.empty()) {
-                    cout << "City name cannot be empty. Please try again." << endl;
-                    break;
-                }
-                
-                infra.addRoad(city1, city2);
-                
-                // Save data after adding a road
-                infra.saveAllData();
-                cout << "\nPress Enter to continue..." << endl;
-                cin.get();
+            entries[pos] = entries[parent];
+            pos = parent;
+        }
+        entries[pos] = Entry{key, node};
+    }
+
+    Entry pop() {
+        Entry top = entries.front();
+        Entry last = entries.back();
+        entries.pop_back();
+        size_t n = entries.size();
+        if (n == 0) {
+            return top;
+        }
+
+        size_t pos = 0;
+        while (true) {
+            size_t first = pos * 4 + 1;
+            if (first >= n) {
                 break;
             }
-            
-            case 3: {
-                printDivider('=', 60);
-                printTitle("ADD BUDGET FOR ROADS", '=', 60);
-                printDivider('-', 60);
-                string city1, city2;
-                double budget;
-                
-                cout << "Enter the name of the first city: ";
-                getline(cin, city1);
-                if (city1.empty()) {
-                    cout << "City name cannot be empty. Please try again." << endl;
-                    break;
-                }
-                
-                cout << "Enter the name of the second city: ";
-                getline(cin, city2);
-                if (city2.empty()) {
-                    cout << "City name cannot be empty. Please try again." << endl;
-                    break;
+            size_t end = min(first + 4, n);
+            size_t best = first;
+            for (size_t c = first + 1; c < end; c++) {
+                if (entries[c].key < entries[best].key) {
+                    best = c;
                 }
-                
-                cout << "Enter the budget for that road: ";
-                if (!(cin >> budget)) {
-                    // Clear the error state
-                    cin.clear();
-                    // Discard invalid input
-                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                    cout << "Invalid budget value. Please enter a number." << endl;
-                    break;
+            }
+            if (entries[best].key >= last.key) {
+                break;
+            }
+            entries[pos] = entries[best];
+            pos = best;
+        }
+        entries[pos] = last;
+        return top;
+    }
+};
+
+// Route search over the road budgets or lengths: A* when the cities'
+// locations give a usable estimate, Dijkstra otherwise. The planner keeps
+// its working arrays between queries; a query only resets the cities it
+// actually reached, using a stamp instead of clearing whole arrays, so
+// repeated queries on a large graph neither allocate nor touch every city.
+class RoutePlanner {
+private:
+    vector<double> distance;
+    vector<int> parent;
+    vector<unsigned> stamp;  // distance/parent are valid when stamp == currentStamp
+    unsigned currentStamp;
+    QuadHeap heap;
+    size_t settled;  // Cities settled by the last search
+
+    void prepare(size_t cityCount) {
+        if (stamp.size() < cityCount) {
+            distance.resize(cityCount);
+            parent.resize(cityCount);
+            stamp.resize(cityCount, 0);
+        }
+        currentStamp++;
+        if (currentStamp == 0) {
+            // The counter wrapped around: old stamps could look current again
+            fill(stamp.begin(), stamp.end(), 0);
+            currentStamp = 1;
+        }
+        heap.clear();
+    }
+
+    bool reached(int city) const {
+        return stamp[city] == currentStamp;
+    }
+
+    // Searches from 'source' in order of cost so far plus estimate(city),
+    // which is Dijkstra when the estimate is zero. weight(from, road) gives
+    // a road's cost, NaN for roads that cannot be used. Stops as soon as
+    // 'target' is settled, or explores everything reachable when target
+    // is -1.
+    template <typename Weight, typename Estimate>
+    void search(const RoadGraph& graph, int source, int target, Weight weight, Estimate estimate) {
+        prepare(graph.getCityCount());
+        settled = 0;
+
+        distance[source] = 0.0;
+        parent[source] = -1;
+        stamp[source] = currentStamp;
+        heap.push(estimate(source), source);
+
+        while (!heap.empty()) {
+            QuadHeap::Entry current = heap.pop();
+            double costSoFar = distance[current.node];
+            // Skip entries left behind by an earlier, more expensive push
+            if (current.key > costSoFar + estimate(current.node)) {
+                continue;
+            }
+            settled++;
+            if (current.node == target) {
+                break;
+            }
+            for (const Road& road : graph.neighbors(current.node)) {
+                double cost = weight(current.node, road);
+                if (isnan(cost)) {
+                    continue;
                 }
-                
-                if (budget <= 0) {
-                    cout << "Budget must be a positive number." << endl;
-                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                    break;
+                double candidate = costSoFar + cost;
+                if (!reached(road.neighbor) || candidate < distance[road.neighbor]) {
+                    distance[road.neighbor] = candidate;
+                    parent[road.neighbor] = current.node;
+                    stamp[road.neighbor] = currentStamp;
+                    heap.push(candidate + estimate(road.neighbor), road.neighbor);
                 }
-                
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                
-                infra.addBudget(city1, city2, budget);
-                
-                // Save data after adding a budget
-                infra.saveAllData();
-                cout << "\nPress Enter to continue..." << endl;
-                cin.get();
-                break;
             }
-            
+        }
+    }
+
+    static double budgetOf(int, const Road& road) { return road.budget; }
+    static double noEstimate(int) { return 0.0; }
+
+public:
+    RoutePlanner() : currentStamp(0), settled(0) {}
+
+    // Finds the route between two city slots with the lowest total budget
+    // or length. On success 'path' holds the slots from source to target
+    // and 'cost' the total.
+    bool findRoute(const RoadGraph& graph, const RouteGeometry& geometry, RouteMetric metric,
+                   int source, int target, vector<int>& path, double& cost) {
+        path.clear();
+        auto estimate = [&](int city) { return geometry.estimate(metric, city, target); };
+        if (metric == RouteMetric::Budget) {
+            search(graph, source, target, budgetOf, estimate);
+        } else {
+            auto length = [&](int from, const Road& road) { return geometry.roadLength(from, road); };
+            search(graph, source, target, length, estimate);
+        }
+
+        if (!reached(target)) {
+            return false;
+        }
+
+        for (int city = target; city != -1; city = parent[city]) {
+            path.push_back(city);
+        }
+        reverse(path.begin(), path.end());
+        cost = distance[target];
+        return true;
+    }
+
+    // Number of cities the last search settled, a measure of its work
+    size_t getSettledCount() const { return settled; }
+
+    // Writes the cheapest cost from 'source' to every city into 'costs'
+    // (one entry per city slot, infinity when unreachable)
+    void computeCosts(const RoadGraph& graph, int source, double* costs) {
+        search(graph, source, -1, budgetOf, noEstimate);
+        size_t n = graph.getCityCount();
+        for (size_t city = 0; city < n; city++) {
+            costs[city] = reached(checkedCast<int>(city)) ? distance[city] : numeric_limits<double>::infinity();
+        }
+    }
+};
+
+// Runs body(0) .. body(count - 1) on all available cores. Items are handed
+// out one at a time, so uneven items still keep every thread busy.
+void parallelFor(size_t count, const function<void(size_t)>& body) {
+    size_t threadCount = max(1u, thread::hardware_concurrency());
+    threadCount = min(threadCount, count);
+    if (threadCount <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            body(i);
+        }
+    };
+
+    vector<thread> threads;
+    for (size_t t = 1; t < threadCount; t++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (thread& t : threads) {
+        t.join();
+    }
+}
+
+// Cheapest cost between every pair of cities, stored row-major in an n x n
+// table. Sparse networks run Dijkstra from every city in parallel; denser
+// ones use a tiled Floyd-Warshall whose tiles fit in cache and whose inner
+// min-plus loop is a plain contiguous loop the compiler vectorizes.
+class AllPairsCosts {
+private:
+    static const size_t TILE = 64;
+
+    vector<double> costs;
+    size_t n;
+    bool usedFloydWarshall;
+
+    double* row(size_t i) { return costs.data() + i * n; }
+
+    // target[j] = min(target[j], via + fromK[j]) over one tile row. Full
+    // tiles use a compile-time width so the loop is vectorized even at -O2.
+    // When the two rows are the same row, via is that row's zero diagonal,
+    // so treating them as non-overlapping gives the same result.
+    static void minPlusRow(double* __restrict target, const double* __restrict fromK, double via, size_t width) {
+        if (width == TILE) {
+            for (size_t j = 0; j < TILE; j++) {
+                double candidate = via + fromK[j];
+                target[j] = candidate < target[j] ? candidate : target[j];
+            }
+            return;
+        }
+        for (size_t j = 0; j < width; j++) {
+            double candidate = via + fromK[j];
+            target[j] = candidate < target[j] ? candidate : target[j];
+        }
+    }
+
+    // One min-plus step over a tile: C[i][j] = min(C[i][j], A[i][k] + B[k][j]).
+    // The k loop is outermost so the update stays correct when C is also
+    // A or B (the diagonal, row and column tiles of a round).
+    void relaxTile(size_t ci, size_t cj, size_t ai, size_t bj, size_t k0) {
+        size_t iEnd = min(ci + TILE, n);
+        size_t jEnd = min(cj + TILE, n);
+        size_t kEnd = min(k0 + TILE, n);
+        size_t width = jEnd - cj;
+        for (size_t k = k0; k < kEnd; k++) {
+            const double* fromK = row(k) + bj;
+            for (size_t i = ci; i < iEnd; i++) {
+                minPlusRow(row(i) + cj, fromK, row(ai + (i - ci))[k], width);
+            }
+        }
+    }
+
+    void floydWarshall(const RoadGraph& graph) {
+        costs.assign(n * n, numeric_limits<double>::infinity());
+        for (size_t i = 0; i < n; i++) {
+            row(i)[i] = 0.0;
+            for (const Road& road : graph.neighbors(i)) {
+                row(i)[road.neighbor] = min(row(i)[road.neighbor], road.budget);
+            }
+        }
+
+        size_t tiles = (n + TILE - 1) / TILE;
+        for (size_t kt = 0; kt < tiles; kt++) {
+            size_t k0 = kt * TILE;
+
+            // Phase 1: the tile on the diagonal depends only on itself
+            relaxTile(k0, k0, k0, k0, k0);
+
+            // Phase 2: tiles in row kt and column kt depend on the diagonal tile
+            parallelFor(tiles * 2, [&](size_t item) {
+                size_t t = item / 2;
+                if (t == kt) {
+                    return;
+                }
+                if (item % 2 == 0) {
+                    relaxTile(k0, t * TILE, k0, t * TILE, k0);
+                } else {
+                    relaxTile(t * TILE, k0, t * TILE, k0, k0);
+                }
+            });
+
+            // Phase 3: every other tile depends on its row and column tiles
+            parallelFor(tiles, [&](size_t it) {
+                if (it == kt) {
+                    return;
+                }
+                for (size_t jt = 0; jt < tiles; jt++) {
+                    if (jt != kt) {
+                        relaxTile(it * TILE, jt * TILE, it * TILE, jt * TILE, k0);
+                    }
+                }
+            });
+        }
+    }
+
+    void repeatedDijkstra(const RoadGraph& graph) {
+        costs.assign(n * n, 0.0);
+        size_t chunk = 64;
+        size_t chunks = (n + chunk - 1) / chunk;
+        parallelFor(chunks, [&](size_t c) {
+            RoutePlanner planner;
+            size_t end = min((c + 1) * chunk, n);
+            for (size_t source = c * chunk; source < end; source++) {
+                planner.computeCosts(graph, checkedCast<int>(source), row(source));
+            }
+        });
+    }
+
+public:
+    // The table holds n * n doubles, so it is refused above this many
+    // cities (2 GB at the limit)
+    static const size_t CITY_LIMIT = 16384;
+
+    AllPairsCosts() : n(0), usedFloydWarshall(false) {}
+
+    void compute(const RoadGraph& graph) {
+        n = graph.getCityCount();
+        // Dijkstra from every city costs about n * m * log(n) against n^3
+        // for Floyd-Warshall; pick whichever is smaller for this network
+        double cityCount = static_cast<double>(n);
+        double edges = 2.0 * static_cast<double>(graph.getRoadCount()) + cityCount;
+        double dijkstraWork = cityCount * edges * log2(cityCount + 2.0);
+        double floydWork = cityCount * cityCount * cityCount;
+        usedFloydWarshall = floydWork < dijkstraWork;
+        if (usedFloydWarshall) {
+            floydWarshall(graph);
+        } else {
+            repeatedDijkstra(graph);
+        }
+    }
+
+    size_t size() const { return n; }
+    bool computedWithFloydWarshall() const { return usedFloydWarshall; }
+
+    double cost(size_t from, size_t to) const { return costs[from * n + to]; }
+};
+
+// Union-find over city slots with path halving and union by size, so any
+// sequence of operations runs in near-constant amortized time per call
+class DisjointSets {
+private:
+    vector<int> parent;
+    vector<int> size;
+
+public:
+    void reset(size_t n) {
+        parent.resize(n);
+        size.assign(n, 1);
+        for (size_t i = 0; i < n; i++) {
+            parent[i] = checkedCast<int>(i);
+        }
+    }
+
+    // Adds a new singleton set and returns its element
+    int addElement() {
+        parent.push_back(checkedCast<int>(parent.size()));
+        size.push_back(1);
+        return checkedCast<int>(parent.size() - 1);
+    }
+
+    int find(int x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    }
+
+    // Merges the sets of a and b. Returns false if they were already one set.
+    bool unite(int a, int b) {
+        a = find(a);
+        b = find(b);
+        if (a == b) {
+            return false;
+        }
+        if (size[a] < size[b]) {
+            swap(a, b);
+        }
+        parent[b] = a;
+        size[a] += size[b];
+        return true;
+    }
+
+    int setSize(int x) { return size[find(x)]; }
+
+    // Rebuilds the sets from component labels where every element's label
+    // is the representative of its set and representatives label themselves
+    void assignLabels(const vector<int>& label) {
+        parent = label;
+        size.assign(label.size(), 0);
+        for (int root : label) {
+            size[root]++;
+        }
+    }
+};
+
+// Labels every city with the smallest slot in its road network. All cities
+// start with their own slot; each round, in parallel, pushes the smaller
+// label across every road (an atomic minimum, so threads may update shared
+// cities) and then shortcuts label[v] = label[label[v]], which cuts the
+// number of rounds on long chains of roads.
+void labelComponents(const RoadGraph& graph, vector<int>& result) {
+    size_t n = graph.getCityCount();
+    vector<atomic<int>> label(n);
+    for (size_t v = 0; v < n; v++) {
+        label[v].store(checkedCast<int>(v), memory_order_relaxed);
+    }
+
+    auto lowerTo = [&](int v, int value) {
+        int current = label[v].load(memory_order_relaxed);
+        while (value < current && !label[v].compare_exchange_weak(current, value, memory_order_relaxed)) {
+        }
+        return value < current;
+    };
+
+    size_t chunk = 4096;
+    size_t chunks = (n + chunk - 1) / chunk;
+    atomic<bool> changed(true);
+    while (changed.load()) {
+        changed.store(false);
+        parallelFor(chunks, [&](size_t c) {
+            bool local = false;
+            size_t end = min((c + 1) * chunk, n);
+            for (size_t v = c * chunk; v < end; v++) {
+                for (const Road& road : graph.neighbors(v)) {
+                    int mine = label[v].load(memory_order_relaxed);
+                    int theirs = label[road.neighbor].load(memory_order_relaxed);
+                    if (theirs < mine) {
+                        local |= lowerTo(checkedCast<int>(v), theirs);
+                    } else if (mine < theirs) {
+                        local |= lowerTo(road.neighbor, mine);
+                    }
+                }
+            }
+            if (local) {
+                changed.store(true, memory_order_relaxed);
+            }
+        });
+        parallelFor(chunks, [&](size_t c) {
+            size_t end = min((c + 1) * chunk, n);
+            for (size_t v = c * chunk; v < end; v++) {
+                int l = label[v].load(memory_order_relaxed);
+                int ll = label[l].load(memory_order_relaxed);
+                while (ll < l) {
+                    l = ll;
+                    ll = label[l].load(memory_order_relaxed);
+                }
+                lowerTo(checkedCast<int>(v), l);
+            }
+        });
+    }
+
+    result.resize(n);
+    for (size_t v = 0; v < n; v++) {
+        result[v] = label[v].load(memory_order_relaxed);
+    }
+}
+
+// Cheapest set of roads that keeps every city connected to everything it
+// can reach (a minimum spanning forest over the road budgets). Small
+// networks use Kruskal; large ones use Boruvka, whose rounds scan all roads
+// in parallel to find the cheapest road leaving each component.
+class SpanningNetwork {
+private:
+    static const size_t PARALLEL_THRESHOLD = 200000;
+
+    vector<RoadEdge> selected;
+    double totalBudget;
+    int componentCount;
+
+    // Strict order on roads: by budget, ties broken by position in the list,
+    // so every component agrees on which road is cheapest
+    static bool cheaper(const vector<RoadEdge>& edges, int a, int b) {
+        if (edges[a].budget != edges[b].budget) {
+            return edges[a].budget < edges[b].budget;
+        }
+        return a < b;
+    }
+
+    void kruskal(size_t cityCount, vector<RoadEdge>& edges, DisjointSets& sets) {
+        sort(edges.begin(), edges.end(), [](const RoadEdge& a, const RoadEdge& b) {
+            return a.budget < b.budget;
+        });
+        for (const RoadEdge& edge : edges) {
+            if (sets.unite(edge.city1, edge.city2)) {
+                selected.push_back(edge);
+                if (selected.size() + 1 == cityCount) {
+                    break;
+                }
+            }
+        }
+    }
+
+    void boruvka(size_t cityCount, const vector<RoadEdge>& edges, DisjointSets& sets) {
+        vector<int> label(cityCount);
+        vector<atomic<int>> cheapest(cityCount);
+        size_t chunk = 1 << 14;
+        size_t chunks = (edges.size() + chunk - 1) / chunk;
+
+        while (true) {
+            // Flatten the sets so the parallel scan only reads labels
+            for (size_t v = 0; v < cityCount; v++) {
+                label[v] = sets.find(checkedCast<int>(v));
+                cheapest[v].store(-1, memory_order_relaxed);
+            }
+
+            parallelFor(chunks, [&](size_t c) {
+                size_t end = min((c + 1) * chunk, edges.size());
+                for (size_t e = c * chunk; e < end; e++) {
+                    int a = label[edges[e].city1];
+                    int b = label[edges[e].city2];
+                    if (a == b) {
+                        continue;
+                    }
+                    int edge = checkedCast<int>(e);
+                    for (int component : {a, b}) {
+                        int current = cheapest[component].load(memory_order_relaxed);
+                        while ((current == -1 || cheaper(edges, edge, current)) &&
+                               !cheapest[component].compare_exchange_weak(current, edge, memory_order_relaxed)) {
+                        }
+                    }
+                }
+            });
+
+            bool merged = false;
+            for (size_t v = 0; v < cityCount; v++) {
+                int e = cheapest[v].load(memory_order_relaxed);
+                if (e != -1 && sets.unite(edges[e].city1, edges[e].city2)) {
+                    selected.push_back(edges[e]);
+                    merged = true;
+                }
+            }
+            if (!merged) {
+                break;
+            }
+        }
+    }
+
+public:
+    SpanningNetwork() : totalBudget(0.0), componentCount(0) {}
+
+    void compute(const RoadGraph& graph) {
+        size_t cityCount = graph.getCityCount();
+        vector<RoadEdge> edges = graph.edgeList();
+        DisjointSets sets;
+        sets.reset(cityCount);
+        selected.clear();
+
+        if (edges.size() >= PARALLEL_THRESHOLD) {
+            boruvka(cityCount, edges, sets);
+        } else {
+            kruskal(cityCount, edges, sets);
+        }
+
+        totalBudget = 0.0;
+        for (const RoadEdge& edge : selected) {
+            totalBudget += edge.budget;
+        }
+        componentCount = checkedCast<int>(cityCount - selected.size());
+    }
+
+    const vector<RoadEdge>& getSelectedRoads() const { return selected; }
+    double getTotalBudget() const { return totalBudget; }
+
+    // Number of separate networks (isolated cities count as one each)
+    int getComponentCount() const { return componentCount; }
+};
+
+// Roads (bridges) and cities (articulation points) whose closure would split
+// their road network, found with Tarjan's depth-first search in linear time.
+// The search keeps its own stack instead of recursing, so networks with
+// millions of roads and very long chains of cities cannot overflow the call
+// stack.
+class CriticalInfrastructure {
+public:
+    struct CriticalRoad {
+        int city1;  // Slots
+        int city2;
+        double budget;
+        int citiesCutOff;  // Cities on the smaller side once it is closed
+    };
+
+    struct CriticalCity {
+        int city;
+        double budget;     // Total budget of its roads
+        int citiesCutOff;  // Cities left outside the largest remaining part
+    };
+
+private:
+    vector<CriticalRoad> roads;
+    vector<CriticalCity> cities;
+
+    // Largest first by budget, then by the number of cities cut off
+    template <typename T>
+    static void rank(vector<T>& list) {
+        sort(list.begin(), list.end(), [](const T& a, const T& b) {
+            if (a.budget != b.budget) {
+                return a.budget > b.budget;
+            }
+            return a.citiesCutOff > b.citiesCutOff;
+        });
+    }
+
+public:
+    void compute(const RoadGraph& graph) {
+        size_t n = graph.getCityCount();
+        roads.clear();
+        cities.clear();
+
+        // discovered[v] is the DFS number of v (-1 until visited); low[v]
+        // the smallest DFS number reachable from v's subtree by one road
+        // that is not in the tree
+        vector<int> discovered(n, -1), low(n), parent(n), subtree(n);
+        vector<int> order;            // Cities in DFS order
+        vector<uint32_t> nextRoad(n, 0);
+        vector<int> separated(n, 0);  // Cities in child subtrees that hang only on v
+        vector<int> largestPiece(n, 0);
+        vector<int> stack;
+        vector<pair<int, int>> bridges;  // (parent, child) of the current network
+        order.reserve(n);
+
+        for (size_t root = 0; root < n; root++) {
+            if (discovered[root] != -1) {
+                continue;
+            }
+            size_t first = order.size();
+            bridges.clear();
+            discovered[root] = low[root] = checkedCast<int>(order.size());
+            parent[root] = -1;
+            subtree[root] = 1;
+            order.push_back(checkedCast<int>(root));
+            stack.push_back(checkedCast<int>(root));
+
+            while (!stack.empty()) {
+                int v = stack.back();
+                const vector<Road>& list = graph.neighbors(v);
+                if (nextRoad[v] < list.size()) {
+                    int w = list[nextRoad[v]++].neighbor;
+                    if (discovered[w] == -1) {
+                        discovered[w] = low[w] = checkedCast<int>(order.size());
+                        parent[w] = v;
+                        subtree[w] = 1;
+                        order.push_back(w);
+                        stack.push_back(w);
+                    } else if (w != parent[v]) {
+                        // There is at most one road between two cities, so
+                        // only the tree road back to the parent is skipped
+                        low[v] = min(low[v], discovered[w]);
+                    }
+                    continue;
+                }
+
+                // v is finished; report it to its parent
+                stack.pop_back();
+                int p = parent[v];
+                if (p == -1) {
+                    continue;
+                }
+                low[p] = min(low[p], low[v]);
+                subtree[p] += subtree[v];
+                if (low[v] > discovered[p]) {
+                    bridges.emplace_back(p, v);
+                }
+                if (low[v] >= discovered[p]) {
+                    separated[p] += subtree[v];
+                    largestPiece[p] = max(largestPiece[p], subtree[v]);
+                }
+            }
+
+            // Sizes of the pieces are only known once the whole network of
+            // 'root' has been searched
+            int networkSize = subtree[root];
+            for (const auto& [p, v] : bridges) {
+                roads.push_back(CriticalRoad{p, v, graph.getBudget(p, v), min(subtree[v], networkSize - subtree[v])});
+            }
+            for (size_t i = first; i < order.size(); i++) {
+                int v = order[i];
+                // Closing v leaves its separated subtrees and, unless v is
+                // the root, the part above it
+                int rest = networkSize - 1 - separated[v];
+                int pieces = (separated[v] > 0) + (rest > 0);
+                if (separated[v] > 0 && (pieces > 1 || largestPiece[v] < separated[v])) {
+                    double budget = 0.0;
+                    for (const Road& road : graph.neighbors(v)) {
+                        budget += road.budget;
+                    }
+                    cities.push_back(CriticalCity{v, budget, networkSize - 1 - max(largestPiece[v], rest)});
+                }
+            }
+        }
+
+        rank(roads);
+        rank(cities);
+    }
+
+    const vector<CriticalRoad>& getRoads() const { return roads; }
+    const vector<CriticalCity>& getCities() const { return cities; }
+};
+
+// Roads ordered by budget, plus the total budget of each city's roads.
+// Top-k and range queries cost O(log n) plus the roads returned; a city's
+// total is O(1). Roads without a budget are indexed with budget 0.
+class BudgetIndex {
+private:
+    set<tuple<double, int, int>> ordered;  // (budget, lower slot, higher slot)
+    vector<double> cityTotals;
+
+    static RoadEdge toEdge(const tuple<double, int, int>& entry) {
+        return RoadEdge{get<1>(entry), get<2>(entry), get<0>(entry)};
+    }
+
+public:
+    void build(const RoadGraph& graph) {
+        ordered.clear();
+        cityTotals.assign(graph.getCityCount(), 0.0);
+        for (const RoadEdge& edge : graph.edgeList()) {
+            addRoad(edge.city1, edge.city2, edge.budget);
+        }
+    }
+
+    void addCity() {
+        cityTotals.push_back(0.0);
+    }
+
+    void addRoad(int a, int b, double budget) {
+        ordered.emplace(budget, min(a, b), max(a, b));
+        cityTotals[a] += budget;
+        cityTotals[b] += budget;
+    }
+
+    void removeRoad(int a, int b, double budget) {
+        ordered.erase(make_tuple(budget, min(a, b), max(a, b)));
+        cityTotals[a] -= budget;
+        cityTotals[b] -= budget;
+    }
+
+    void changeBudget(int a, int b, double oldBudget, double newBudget) {
+        ordered.erase(make_tuple(oldBudget, min(a, b), max(a, b)));
+        ordered.emplace(newBudget, min(a, b), max(a, b));
+        cityTotals[a] += newBudget - oldBudget;
+        cityTotals[b] += newBudget - oldBudget;
+    }
+
+    double cityTotal(int slot) const { return cityTotals[slot]; }
+
+    // The k roads with the highest budgets, most expensive first
+    vector<RoadEdge> mostExpensive(size_t k) const {
+        vector<RoadEdge> result;
+        for (auto it = ordered.rbegin(); it != ordered.rend() && result.size() < k; ++it) {
+            result.push_back(toEdge(*it));
+        }
+        return result;
+    }
+
+    // Roads whose budget is between low and high inclusive, cheapest first
+    vector<RoadEdge> inRange(double low, double high) const {
+        vector<RoadEdge> result;
+        const int lowest = numeric_limits<int>::min(), highest = numeric_limits<int>::max();
+        auto first = ordered.lower_bound(make_tuple(low, lowest, lowest));
+        auto last = ordered.upper_bound(make_tuple(high, highest, highest));
+        for (auto it = first; it != last; ++it) {
+            result.push_back(toEdge(*it));
+        }
+        return result;
+    }
+};
+
+// Walks a text buffer line by line without copying. Lines end at '\n'; a
+// '\r' before it (files saved on Windows) is dropped.
+class LineCursor {
+private:
+    const char* pos;
+    const char* end;
+
+public:
+    LineCursor(const char* begin, size_t size) : pos(begin), end(begin + size) {}
+
+    bool next(string_view& line) {
+        if (pos == end) {
+            return false;
+        }
+        const char* newline = (const char*)memchr(pos, '\n', end - pos);
+        const char* lineEnd = newline ? newline : end;
+        line = string_view(pos, lineEnd - pos);
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        pos = newline ? newline + 1 : end;
+        return true;
+    }
+};
+
+// Parsing helpers for string_view input. Each one reads a value from the
+// front of 'text' and removes what it read; on failure 'text' is unchanged.
+inline bool consumeInt(string_view& text, int& value) {
+    size_t start = text.find_first_not_of(' ');
+    if (start == string_view::npos) {
+        return false;
+    }
+    auto result = from_chars(text.data() + start, text.data() + text.size(), value);
+    if (result.ec != errc()) {
+        return false;
+    }
+    text.remove_prefix(result.ptr - text.data());
+    return true;
+}
+
+inline bool consumeDouble(string_view& text, double& value) {
+    size_t start = text.find_first_not_of(' ');
+    if (start == string_view::npos) {
+        return false;
+    }
+    auto result = from_chars(text.data() + start, text.data() + text.size(), value);
+    if (result.ec != errc()) {
+        return false;
+    }
+    text.remove_prefix(result.ptr - text.data());
+    return true;
+}
+
+inline void skipTabs(string_view& text) {
+    size_t start = text.find_first_not_of('\t');
+    text.remove_prefix(start == string_view::npos ? text.size() : start);
+}
+
+// Text built up in memory and written out with a single call, instead of
+// formatting through cout field by field and flushing on every line.
+// Numbers are formatted with to_chars. padLeft right-aligns a value in a
+// field the way setw does, never cutting it short.
+class TextBuffer {
+private:
+    string text;
+
+public:
+    void reserve(size_t bytes) { text.reserve(bytes); }
+    size_t size() const { return text.size(); }
+    const string& str() const { return text; }
+
+    TextBuffer& append(string_view value) {
+        text.append(value);
+        return *this;
+    }
+
+    TextBuffer& append(long long value) {
+        char digits[24];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        text.append(digits, result.ptr);
+        return *this;
+    }
+
+    TextBuffer& padding(int count) {
+        if (count > 0) {
+            text.append(count, ' ');
+        }
+        return *this;
+    }
+
+    TextBuffer& padLeft(string_view value, int width) {
+        padding(width - (int)value.size());
+        text.append(value);
+        return *this;
+    }
+
+    TextBuffer& padLeft(long long value, int width) {
+        char digits[24];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        return padLeft(string_view(digits, result.ptr - digits), width);
+    }
+
+    // Fixed-point with 'precision' decimals, like fixed << setprecision
+    TextBuffer& padLeft(double value, int width, int precision) {
+        char digits[64];
+        auto result = to_chars(digits, digits + sizeof(digits), value, chars_format::fixed, precision);
+        if (result.ec != errc()) {
+            return padLeft("?", width);
+        }
+        return padLeft(string_view(digits, result.ptr - digits), width);
+    }
+
+    TextBuffer& newline() {
+        text.push_back('\n');
+        return *this;
+    }
+
+    // Same output as printDivider and printTitle
+    void divider(char symbol, int length) {
+        text.append(length, symbol);
+        newline();
+    }
+
+    void title(const string& title, char symbol, int length) {
+        int padding = (length - (int)title.length()) / 2;
+        text.append(max(padding, 0), symbol);
+        text.append(" ").append(title).append(" ");
+        text.append(max(padding - (title.length() % 2 == 0 ? 0 : 1), 0), symbol);
+        newline();
+    }
+
+    void writeTo(ostream& out) const {
+        out.write(text.data(), text.size());
+        out.flush();
+    }
+
+    bool writeToFile(const string& filename) const {
+        ofstream file(filename, ios::binary | ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        file.write(text.data(), text.size());
+        return (bool)file;
+    }
+};
+
+// Where a long report goes
+enum class ReportView { Paged, Pager, File };
+
+// Prints 'text' a page at a time, waiting for Enter between pages. Typing
+// q stops early.
+void pageThrough(const string& text, size_t linesPerPage) {
+    LineCursor lines(text.data(), text.size());
+    string_view line;
+    string page;
+    size_t count = 0;
+    while (lines.next(line)) {
+        page.append(line).push_back('\n');
+        if (++count % linesPerPage == 0) {
+            cout << page << "-- Press Enter for more, or q to stop --" << flush;
+            page.clear();
+            string answer;
+            getline(cin, answer);
+            if (answer == "q" || answer == "Q" || !cin) {
+                return;
+            }
+        }
+    }
+    cout << page << flush;
+}
+
+// Sends 'text' to $PAGER (or less). Returns false if no pager could be run.
+bool sendToPager(const string& text) {
+    const char* pager = getenv("PAGER");
+    // A pager that quits before reading everything closes the pipe, which
+    // must not end the program
+    auto previous = signal(SIGPIPE, SIG_IGN);
+    FILE* pipe = popen(pager != nullptr && *pager != '\0' ? pager : "less", "w");
+    if (pipe == nullptr) {
+        signal(SIGPIPE, previous);
+        return false;
+    }
+    bool complete = fwrite(text.data(), 1, text.size(), pipe) == text.size();
+    complete = fflush(pipe) == 0 && complete;
+    int status = pclose(pipe);
+    signal(SIGPIPE, previous);
+    if (status == -1) {
+        return false;
+    }
+    // The shell exits with 127 when the pager is not installed; a pager
+    // that failed without reading the text did not show it either
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 0;
+    return code != 127 && (complete || code == 0);
+}
+
+// Operations whose latency is tracked by OperationStats
+enum class Operation {
+    LoadCities,
+    LoadRoads,
+    LoadSnapshot,
+    ReplayJournal,
+    SaveAll,
+    FindCityByName,
+    AddCity,
+    AddRoad,
+    AddBudget,
+    EditCity,
+    CheapestRoute,
+    RenderReport,
+    BuildHierarchy,
+    DeleteCity,
+    DeleteRoad,
+    CompactCities,
+    LoadRegion,
+    Count
+};
+
+// Per-operation call counts and latency histograms. Each histogram bucket
+// covers a power of two of nanoseconds, so recording a call is a couple of
+// additions; when collection is off a timer costs a single branch. It is
+// off unless turned on with --stats or from the statistics menu.
+class OperationStats {
+private:
+    static const size_t BUCKETS = 40;  // Up to 2^39 ns, about nine minutes
+
+    struct Counter {
+        uint64_t calls = 0;
+        uint64_t totalNanos = 0;
+        uint64_t maxNanos = 0;
+        array<uint64_t, BUCKETS> buckets{};
+    };
+
+    array<Counter, (size_t)Operation::Count> counters;
+    bool enabled = false;
+
+    static const char* name(Operation operation) {
+        static const char* names[] = {"loadCitiesFromFile", "loadRoadsFromFile", "loadSnapshot",
+                                      "replayJournal", "saveAllData", "findCityIndexByName",
+                                      "addCity", "addRoad", "addBudget", "editCity",
+                                      "cheapestRoute", "renderReport", "buildHierarchy",
+                                      "deleteCity", "deleteRoad", "compactCities", "loadRegion"};
+        return names[(size_t)operation];
+    }
+
+    // Upper bound of the bucket holding the p-th fraction of the calls
+    static uint64_t percentile(const Counter& counter, double p) {
+        uint64_t target = max<uint64_t>(1, (uint64_t)ceil(p * static_cast<double>(counter.calls)));
+        uint64_t seen = 0;
+        for (size_t b = 0; b < BUCKETS; b++) {
+            seen += counter.buckets[b];
+            if (seen >= target) {
+                return min(counter.maxNanos, (uint64_t(1) << b) - 1);
+            }
+        }
+        return counter.maxNanos;
+    }
+
+public:
+    // Times one call from construction to destruction
+    class Timer {
+    private:
+        OperationStats* stats;
+        Operation operation;
+        chrono::steady_clock::time_point start;
+
+    public:
+        Timer(OperationStats& owner, Operation timed)
+            : stats(owner.enabled ? &owner : nullptr), operation(timed) {
+            if (stats != nullptr) {
+                start = chrono::steady_clock::now();
+            }
+        }
+        ~Timer() {
+            if (stats != nullptr) {
+                stats->record(operation, chrono::duration_cast<chrono::nanoseconds>(
+                                             chrono::steady_clock::now() - start).count());
+            }
+        }
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+    };
+
+    Timer time(Operation operation) { return Timer(*this, operation); }
+
+    void record(Operation operation, uint64_t nanos) {
+        Counter& counter = counters[(size_t)operation];
+        counter.calls++;
+        counter.totalNanos += nanos;
+        counter.maxNanos = max(counter.maxNanos, nanos);
+        counter.buckets[min<size_t>(BUCKETS - 1, bit_width(nanos))]++;
+    }
+
+    bool isEnabled() const { return enabled; }
+    void setEnabled(bool on) { enabled = on; }
+    void reset() { counters = {}; }
+
+    // Table of the operations called so far, times in microseconds
+    void render(TextBuffer& out) const {
+        out.padLeft("OPERATION", 22).padLeft("CALLS", 10).padLeft("MEAN", 12).padLeft("P50", 12)
+           .padLeft("P99", 12).padLeft("MAX", 12).newline();
+        out.divider('-', 80);
+        for (size_t i = 0; i < counters.size(); i++) {
+            const Counter& counter = counters[i];
+            if (counter.calls == 0) {
+                continue;
+            }
+            out.padLeft(name((Operation)i), 22).padLeft((long long)counter.calls, 10)
+               .padLeft(static_cast<double>(counter.totalNanos) / 1000.0 / static_cast<double>(counter.calls), 12, 2)
+               .padLeft(static_cast<double>(percentile(counter, 0.5)) / 1000.0, 12, 2)
+               .padLeft(static_cast<double>(percentile(counter, 0.99)) / 1000.0, 12, 2)
+               .padLeft(static_cast<double>(counter.maxNanos) / 1000.0, 12, 2).newline();
+        }
+        out.append("(times in microseconds; P50 and P99 are histogram bucket bounds)").newline();
+    }
+
+    // Every counter as JSON, histograms listing only non-empty buckets
+    void renderJson(TextBuffer& out) const {
+        out.append("{\n  \"operations\": [");
+        bool first = true;
+        for (size_t i = 0; i < counters.size(); i++) {
+            const Counter& counter = counters[i];
+            out.append(first ? "\n" : ",\n");
+            first = false;
+            out.append("    {\"name\": \"").append(name((Operation)i)).append("\", \"calls\": ")
+               .append((long long)counter.calls).append(", \"total_ns\": ").append((long long)counter.totalNanos)
+               .append(", \"max_ns\": ").append((long long)counter.maxNanos)
+               .append(", \"p50_ns\": ").append((long long)percentile(counter, 0.5))
+               .append(", \"p90_ns\": ").append((long long)percentile(counter, 0.9))
+               .append(", \"p99_ns\": ").append((long long)percentile(counter, 0.99))
+               .append(", \"histogram\": [");
+            bool firstBucket = true;
+            for (size_t b = 0; b < BUCKETS; b++) {
+                if (counter.buckets[b] == 0) {
+                    continue;
+                }
+                out.append(firstBucket ? "" : ", ").append("{\"below_ns\": ").append((long long)(uint64_t(1) << b))
+                   .append(", \"calls\": ").append((long long)counter.buckets[b]).append("}");
+                firstBucket = false;
+            }
+            out.append("]}");
+        }
+        out.append("\n  ]\n}\n");
+    }
+};
+
+// Read-only memory mapping of a whole file, unmapped when destroyed
+class MappedFile {
+private:
+    const char* data;
+    size_t length;
+
+public:
+    MappedFile() : data(nullptr), length(0) {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data != nullptr) {
+            munmap((void*)data, length);
+        }
+    }
+
+    bool open(const char* path) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == -1) {
+            close(fd);
+            return false;
+        }
+        if (info.st_size == 0) {
+            // Nothing to map; an empty file is still a valid (empty) file
+            close(fd);
+            return true;
+        }
+        void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        data = (const char*)mapped;
+        length = info.st_size;
+        return true;
+    }
+
+    const char* begin() const { return data; }
+    size_t size() const { return length; }
+};
+
+// Layout of infrastructure.snap, a binary image of the data that loads
+// without any parsing. After the header come, each 8-byte aligned:
+//   SnapshotCity[cityCount]   public index and where the name is in the blob
+//   SnapshotRegion[regionCount] where each region's name is in the blob
+//   char[nameBytes]           all city names, then all region names
+//   uint64_t[cityCount + 1]   where each city's roads start in the road array
+//   Road[roadEntries]         every road from both ends, sorted by neighbor
+// Numbers are stored in the machine's native byte order.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t cityCount;
+    uint64_t regionCount;
+    uint64_t nameBytes;
+    uint64_t roadEntries;
+    int64_t highestIndex;  // Largest public index ever handed out
+};
+
+struct SnapshotCity {
+    int32_t index;
+    uint32_t nameLength;
+    uint64_t nameOffset;
+    double latitude;   // NaN when the city has no location
+    double longitude;
+    uint32_t region;
+    uint32_t unused;
+};
+
+struct SnapshotRegion {
+    uint64_t nameOffset;
+    uint64_t nameLength;
+};
+
+// Version 2 added city locations and road lengths, version 3 regions,
+// version 4 the highest index handed out; older snapshots are ignored and
+// the text files loaded instead
+const char SNAPSHOT_MAGIC[8] = {'R', 'W', 'I', 'N', 'F', 'R', 'A', '\0'};
+const uint32_t SNAPSHOT_VERSION = 4;
+
+// Roads are copied straight from the file into the graph, so the file
+// layout must match the in-memory one
+static_assert(sizeof(Road) == 16 && offsetof(Road, length) == 4 && offsetof(Road, budget) == 8,
+              "unexpected Road layout");
+
+inline uint64_t alignTo8(uint64_t size) {
+    return (size + 7) & ~uint64_t(7);
+}
+
+// Contraction hierarchy over the road budgets, for fast repeated
+// cheapest-route queries on a network that rarely changes. Cities are
+// contracted one after another: contracting a city removes it and joins
+// its neighbors with a shortcut wherever the route through it was the only
+// cheapest one. A query then only searches towards later-contracted cities,
+// from both ends at once, and touches a few hundred cities instead of a
+// large part of the network.
+//
+// Each round contracts the cities that have a lower priority than all of
+// their neighbors; they share no roads, so their shortcuts are worked out
+// in parallel. Whatever is still densely connected at the end (the "core")
+// is left as it is and searched like plain Dijkstra.
+class ContractionHierarchy {
+public:
+    // Upward edge; middle is the contracted city a shortcut skips, or -1
+    // for a real road
+    struct Edge {
+        int target;
+        int middle;
+        double weight;
+    };
+
+private:
+    vector<int> rank;            // Contraction order; core cities share the highest
+    vector<uint64_t> firstEdge;  // Edges of city i: edges[firstEdge[i]] .. edges[firstEdge[i + 1] - 1]
+    vector<Edge> edges;
+    uint64_t fingerprint;
+    size_t shortcutCount;
+    size_t coreSize;
+
+    // Rounds stop once the cities left have this many roads each on average
+    static constexpr double CORE_DEGREE = 40.0;
+    // A witness search gives up after settling this many cities, or after
+    // scanning WITNESS_SCAN_LIMIT arcs when it runs into hubs; the shortcut
+    // is then added even if it might not have been needed. Priorities only
+    // estimate the shortcuts, so their searches stop sooner.
+    static const size_t WITNESS_SETTLE_LIMIT = 500;
+    static const size_t PRIORITY_SETTLE_LIMIT = 10;
+    static const size_t WITNESS_SCAN_LIMIT = 3000;
+    // Cities with more roads than this (hubs) get a worst-case priority
+    // instead of a search, as they would be re-evaluated after every round
+    static const size_t ESTIMATE_DEGREE = 16;
+
+    struct Shortcut {
+        int from;
+        int to;
+        double weight;
+    };
+
+    // Dijkstra limited in cost and size, used to check whether a route
+    // around the city being contracted costs no more than the one through it.
+    // It stops as soon as every city it is looking for has been settled.
+    class WitnessSearch {
+    private:
+        vector<double> distance;
+        vector<unsigned> stamp;
+        vector<unsigned> wanted;
+        unsigned currentStamp = 0;
+        QuadHeap heap;
+
+    public:
+        // Searches from 'source' for the cities targets[first..], not going
+        // through 'avoid', cities marked in 'skip' or beyond cost 'limit'
+        void run(const vector<vector<Edge>>& arcs, const vector<char>& skip, int source, int avoid,
+                 const vector<Edge>& targets, size_t first, double limit, size_t settleLimit) {
+            if (stamp.size() < arcs.size()) {
+                distance.resize(arcs.size());
+                stamp.resize(arcs.size(), 0);
+                wanted.resize(arcs.size(), 0);
+            }
+            if (++currentStamp == 0) {
+                fill(stamp.begin(), stamp.end(), 0);
+                fill(wanted.begin(), wanted.end(), 0);
+                currentStamp = 1;
+            }
+            size_t missing = 0;
+            for (size_t j = first; j < targets.size(); j++) {
+                wanted[targets[j].target] = currentStamp;
+                missing++;
+            }
+            heap.clear();
+            distance[source] = 0.0;
+            stamp[source] = currentStamp;
+            heap.push(0.0, source);
+            size_t settled = 0, scanned = 0;
+            while (!heap.empty() && missing > 0 && settled < settleLimit) {
+                QuadHeap::Entry current = heap.pop();
+                if (current.key > distance[current.node]) {
+                    continue;
+                }
+                settled++;
+                scanned += arcs[current.node].size();
+                if (scanned > WITNESS_SCAN_LIMIT) {
+                    break;
+                }
+                if (wanted[current.node] == currentStamp) {
+                    missing--;
+                }
+                for (const Edge& arc : arcs[current.node]) {
+                    if (arc.target == avoid || skip[arc.target]) {
+                        continue;
+                    }
+                    double candidate = current.key + arc.weight;
+                    if (candidate > limit) {
+                        continue;
+                    }
+                    if (stamp[arc.target] != currentStamp || candidate < distance[arc.target]) {
+                        distance[arc.target] = candidate;
+                        stamp[arc.target] = currentStamp;
+                        heap.push(candidate, arc.target);
+                    }
+                }
+            }
+        }
+
+        // Cost of the cheapest route found to 'city', infinity if none
+        double distanceTo(int city) const {
+            return stamp[city] == currentStamp ? distance[city] : numeric_limits<double>::infinity();
+        }
+    };
+
+    // Shortcuts that contracting v would need, given the cities still left
+    static void findShortcuts(const vector<vector<Edge>>& arcs, const vector<char>& skip, int v,
+                              WitnessSearch& search, size_t settleLimit, vector<Shortcut>& out) {
+        out.clear();
+        const vector<Edge>& around = arcs[v];
+        for (size_t i = 0; i + 1 < around.size(); i++) {
+            double longest = 0.0;
+            for (size_t j = i + 1; j < around.size(); j++) {
+                longest = max(longest, around[j].weight);
+            }
+            search.run(arcs, skip, around[i].target, v, around, i + 1, around[i].weight + longest, settleLimit);
+            for (size_t j = i + 1; j < around.size(); j++) {
+                double through = around[i].weight + around[j].weight;
+                if (search.distanceTo(around[j].target) > through) {
+                    out.push_back(Shortcut{around[i].target, around[j].target, through});
+                }
+            }
+        }
+    }
+
+    // Adds an arc from -> to, or makes the existing one cheaper
+    static void addArc(vector<Edge>& list, int to, int middle, double weight) {
+        for (Edge& arc : list) {
+            if (arc.target == to) {
+                if (weight < arc.weight) {
+                    arc.middle = middle;
+                    arc.weight = weight;
+                }
+                return;
+            }
+        }
+        list.push_back(Edge{to, middle, weight});
+    }
+
+    static void removeArc(vector<Edge>& list, int to) {
+        for (size_t i = 0; i < list.size(); i++) {
+            if (list[i].target == to) {
+                list[i] = list.back();
+                list.pop_back();
+                return;
+            }
+        }
+    }
+
+    const Edge* findEdge(int a, int b) const {
+        for (uint64_t e = firstEdge[a]; e < firstEdge[a + 1]; e++) {
+            if (edges[e].target == b) {
+                return &edges[e];
+            }
+        }
+        for (uint64_t e = firstEdge[b]; e < firstEdge[b + 1]; e++) {
+            if (edges[e].target == a) {
+                return &edges[e];
+            }
+        }
+        return nullptr;
+    }
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerSize;
+        uint64_t cityCount;
+        uint64_t edgeCount;
+        uint64_t fingerprint;
+        uint64_t shortcutCount;
+        uint64_t coreSize;
+    };
+
+public:
+    ContractionHierarchy() : fingerprint(0), shortcutCount(0), coreSize(0) {}
+
+    // Identifies the budgets and roads a hierarchy was built for
+    static uint64_t fingerprintOf(const RoadGraph& graph) {
+        uint64_t hash = 14695981039346656037ull;  // FNV-1a
+        auto mix = [&](uint64_t value) {
+            for (int i = 0; i < 8; i++) {
+                hash = (hash ^ ((value >> (8 * i)) & 0xff)) * 1099511628211ull;
+            }
+        };
+        mix(graph.getCityCount());
+        for (size_t i = 0; i < graph.getCityCount(); i++) {
+            for (const Road& road : graph.neighbors(i)) {
+                mix(road.neighbor);
+                mix(bit_cast<uint64_t>(road.budget));
+            }
+            mix(~uint64_t(0));
+        }
+        return hash;
+    }
+
+    size_t getCityCount() const { return rank.size(); }
+    size_t getShortcutCount() const { return shortcutCount; }
+    size_t getCoreSize() const { return coreSize; }
+    uint64_t getFingerprint() const { return fingerprint; }
+
+    const Edge* edgesBegin(int city) const { return edges.data() + firstEdge[city]; }
+    const Edge* edgesEnd(int city) const { return edges.data() + firstEdge[city + 1]; }
+
+    void build(const RoadGraph& graph) {
+        size_t n = graph.getCityCount();
+        fingerprint = fingerprintOf(graph);
+        shortcutCount = 0;
+
+        // The network still to be contracted, shortcuts included
+        vector<vector<Edge>> arcs(n);
+        for (size_t i = 0; i < n; i++) {
+            for (const Road& road : graph.neighbors(i)) {
+                arcs[i].push_back(Edge{road.neighbor, -1, road.budget});
+            }
+        }
+        vector<vector<Edge>> upward(n);
+        rank.assign(n, 0);
+
+        size_t threadCount = max(1u, thread::hardware_concurrency());
+        vector<WitnessSearch> searchers(threadCount);
+        // Runs body(city, searcher) for every city in 'list', each thread
+        // with its own searcher
+        auto forEach = [&](const vector<int>& list, auto body) {
+            parallelFor(threadCount, [&](size_t t) {
+                for (size_t i = t; i < list.size(); i += threadCount) {
+                    body(i, list[i], searchers[t]);
+                }
+            });
+        };
+
+        // Priority: shortcuts added minus roads removed, plus neighbors
+        // already contracted so that contraction spreads evenly
+        vector<int> priority(n, 0);
+        vector<int> contractedNeighbors(n, 0);
+        vector<char> skip(n, 0);
+        auto updatePriority = [&](size_t, int v, WitnessSearch& search) {
+            long long degree = arcs[v].size();
+            long long added = degree * (degree - 1) / 2;
+            if (degree <= (long long)ESTIMATE_DEGREE) {
+                vector<Shortcut> shortcuts;
+                findShortcuts(arcs, skip, v, search, PRIORITY_SETTLE_LIMIT, shortcuts);
+                added = shortcuts.size();
+            }
+            priority[v] = (int)min<long long>(added - degree + contractedNeighbors[v], numeric_limits<int>::max());
+        };
+        auto before = [&](int a, int b) {
+            uint32_t ta = (uint32_t)a * 2654435761u, tb = (uint32_t)b * 2654435761u;  // Scrambled tie-break
+            return priority[a] != priority[b] ? priority[a] < priority[b] : ta != tb ? ta < tb : a < b;
+        };
+
+        vector<int> remaining(n);
+        iota(remaining.begin(), remaining.end(), 0);
+        forEach(remaining, updatePriority);
+
+        vector<char> selected(n, 0);
+        vector<char> stale(n, 0);
+        vector<vector<Shortcut>> shortcuts;
+        int nextRank = 0;
+        size_t remainingArcs = 2 * graph.getRoadCount();
+        while (!remaining.empty() && (double)remainingArcs / static_cast<double>(remaining.size()) <= CORE_DEGREE) {
+            forEach(remaining, [&](size_t, int v, WitnessSearch&) {
+                bool lowest = true;
+                for (const Edge& arc : arcs[v]) {
+                    lowest = lowest && before(v, arc.target);
+                }
+                selected[v] = lowest;
+            });
+            vector<int> round;
+            for (int v : remaining) {
+                if (selected[v]) {
+                    round.push_back(v);
+                    skip[v] = 1;
+                }
+            }
+
+            shortcuts.resize(round.size());
+            forEach(round, [&](size_t i, int v, WitnessSearch& search) {
+                findShortcuts(arcs, skip, v, search, WITNESS_SETTLE_LIMIT, shortcuts[i]);
+            });
+
+            for (size_t i = 0; i < round.size(); i++) {
+                int v = round[i];
+                rank[v] = nextRank++;
+                for (const Edge& arc : arcs[v]) {
+                    removeArc(arcs[arc.target], v);
+                    contractedNeighbors[arc.target]++;
+                    stale[arc.target] = 1;
+                    remainingArcs -= 2;
+                }
+                for (const Shortcut& shortcut : shortcuts[i]) {
+                    size_t oldSize = arcs[shortcut.from].size();
+                    addArc(arcs[shortcut.from], shortcut.to, v, shortcut.weight);
+                    addArc(arcs[shortcut.to], shortcut.from, v, shortcut.weight);
+                    if (arcs[shortcut.from].size() > oldSize) {
+                        remainingArcs += 2;
+                        shortcutCount++;
+                    }
+                }
+                upward[v] = move(arcs[v]);
+                arcs[v] = vector<Edge>();
+            }
+
+            vector<int> changed;
+            size_t kept = 0;
+            for (int v : remaining) {
+                if (!selected[v]) {
+                    remaining[kept++] = v;
+                    if (stale[v]) {
+                        changed.push_back(v);
+                        stale[v] = 0;
+                    }
+                }
+            }
+            remaining.resize(kept);
+            forEach(changed, updatePriority);
+        }
+
+        // The core: every city left keeps all its arcs, in both directions
+        coreSize = remaining.size();
+        for (int v : remaining) {
+            rank[v] = nextRank;
+            upward[v] = move(arcs[v]);
+        }
+
+        firstEdge.assign(n + 1, 0);
+        for (size_t i = 0; i < n; i++) {
+            firstEdge[i + 1] = firstEdge[i] + upward[i].size();
+        }
+        edges.clear();
+        edges.reserve(firstEdge[n]);
+        for (size_t i = 0; i < n; i++) {
+            edges.insert(edges.end(), upward[i].begin(), upward[i].end());
+        }
+    }
+
+    // Appends the cities after 'from' on the real roads that the edge
+    // from -> to stands for, ending with 'to'
+    void unpack(int from, int to, vector<int>& path) const {
+        vector<pair<int, int>> pending = {{from, to}};
+        while (!pending.empty()) {
+            auto [a, b] = pending.back();
+            pending.pop_back();
+            const Edge* edge = findEdge(a, b);
+            if (edge->middle == -1) {
+                path.push_back(b);
+            } else {
+                pending.push_back({edge->middle, b});
+                pending.push_back({a, edge->middle});
+            }
+        }
+    }
+
+    // Written under a temporary name and renamed, like the snapshot
+    bool save(const string& filename) const {
+        FileHeader header;
+        memcpy(header.magic, "RWCH\0\0\0\0", sizeof(header.magic));
+        header.version = 1;
+        header.headerSize = sizeof(FileHeader);
+        header.cityCount = rank.size();
+        header.edgeCount = edges.size();
+        header.fingerprint = fingerprint;
+        header.shortcutCount = shortcutCount;
+        header.coreSize = coreSize;
+
+        string tempName = filename + ".tmp";
+        ofstream file(tempName, ios::binary | ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        const char padding[8] = {0};
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)rank.data(), rank.size() * sizeof(int));
+        file.write(padding, alignTo8(rank.size() * sizeof(int)) - rank.size() * sizeof(int));
+        file.write((const char*)firstEdge.data(), firstEdge.size() * sizeof(uint64_t));
+        file.write((const char*)edges.data(), edges.size() * sizeof(Edge));
+        file.close();
+        return file && rename(tempName.c_str(), filename.c_str()) == 0;
+    }
+
+    // Loads a saved hierarchy if it was built for exactly 'graph'.
+    // Returns false, leaving this one untouched, otherwise.
+    bool load(const string& filename, const RoadGraph& graph) {
+        MappedFile file;
+        if (!file.open(filename.c_str()) || file.size() < sizeof(FileHeader)) {
+            return false;
+        }
+        FileHeader header;
+        memcpy(&header, file.begin(), sizeof(header));
+        uint64_t cityCount = graph.getCityCount();
+        if (memcmp(header.magic, "RWCH\0\0\0\0", sizeof(header.magic)) != 0 || header.version != 1 ||
+            header.headerSize != sizeof(FileHeader) || header.cityCount != cityCount ||
+            header.edgeCount > file.size() || header.fingerprint != fingerprintOf(graph)) {
+            return false;
+        }
+        uint64_t offsetsStart = sizeof(FileHeader) + alignTo8(cityCount * sizeof(int));
+        uint64_t edgesStart = offsetsStart + (cityCount + 1) * sizeof(uint64_t);
+        if (edgesStart + header.edgeCount * sizeof(Edge) != file.size()) {
+            return false;
+        }
+        const int* ranks = (const int*)(file.begin() + sizeof(FileHeader));
+        const uint64_t* offsets = (const uint64_t*)(file.begin() + offsetsStart);
+        const Edge* list = (const Edge*)(file.begin() + edgesStart);
+        if (offsets[0] != 0 || offsets[cityCount] != header.edgeCount) {
+            return false;
+        }
+        for (uint64_t i = 0; i < cityCount; i++) {
+            if (offsets[i] > offsets[i + 1]) {
+                return false;
+            }
+        }
+        for (uint64_t e = 0; e < header.edgeCount; e++) {
+            if (list[e].target < 0 || (uint64_t)list[e].target >= cityCount || list[e].middle < -1 ||
+                list[e].middle >= (int64_t)cityCount) {
+                return false;
+            }
+        }
+
+        rank.assign(ranks, ranks + cityCount);
+        firstEdge.assign(offsets, offsets + cityCount + 1);
+        edges.assign(list, list + header.edgeCount);
+        fingerprint = header.fingerprint;
+        shortcutCount = header.shortcutCount;
+        coreSize = header.coreSize;
+        return true;
+    }
+};
+
+// Cheapest-route queries over a ContractionHierarchy: Dijkstra from both
+// ends along upward edges, stopping once neither side can improve on the
+// best meeting point. Keeps its arrays between queries like RoutePlanner.
+class HierarchyQuery {
+private:
+    vector<double> distance[2];
+    vector<int> parent[2];
+    vector<unsigned> stamp[2];
+    unsigned currentStamp;
+    QuadHeap heap[2];
+    size_t settled;
+
+    bool reached(int side, int city) const { return stamp[side][city] == currentStamp; }
+
+public:
+    HierarchyQuery() : currentStamp(0), settled(0) {}
+
+    size_t getSettledCount() const { return settled; }
+
+    bool findRoute(const ContractionHierarchy& hierarchy, int source, int target, vector<int>& path, double& cost) {
+        size_t n = hierarchy.getCityCount();
+        for (int side = 0; side < 2; side++) {
+            if (stamp[side].size() < n) {
+                distance[side].resize(n);
+                parent[side].resize(n);
+                stamp[side].resize(n, 0);
+            }
+            heap[side].clear();
+        }
+        if (++currentStamp == 0) {
+            fill(stamp[0].begin(), stamp[0].end(), 0);
+            fill(stamp[1].begin(), stamp[1].end(), 0);
+            currentStamp = 1;
+        }
+        settled = 0;
+        path.clear();
+
+        const int ends[2] = {source, target};
+        for (int side = 0; side < 2; side++) {
+            distance[side][ends[side]] = 0.0;
+            parent[side][ends[side]] = -1;
+            stamp[side][ends[side]] = currentStamp;
+            heap[side].push(0.0, ends[side]);
+        }
+
+        const double infinity = numeric_limits<double>::infinity();
+        double best = infinity;
+        int meeting = -1;
+        while (true) {
+            double top[2];
+            for (int side = 0; side < 2; side++) {
+                top[side] = heap[side].empty() ? infinity : heap[side].top().key;
+            }
+            if (min(top[0], top[1]) >= best || (top[0] == infinity && top[1] == infinity)) {
+                break;
+            }
+            int side = top[0] <= top[1] ? 0 : 1;
+            QuadHeap::Entry current = heap[side].pop();
+            if (current.key > distance[side][current.node]) {
+                continue;
+            }
+            settled++;
+            if (reached(1 - side, current.node) && current.key + distance[1 - side][current.node] < best) {
+                best = current.key + distance[1 - side][current.node];
+                meeting = current.node;
+            }
+            for (const auto* edge = hierarchy.edgesBegin(current.node); edge != hierarchy.edgesEnd(current.node); ++edge) {
+                double candidate = current.key + edge->weight;
+                if (!reached(side, edge->target) || candidate < distance[side][edge->target]) {
+                    distance[side][edge->target] = candidate;
+                    parent[side][edge->target] = current.node;
+                    stamp[side][edge->target] = currentStamp;
+                    heap[side].push(candidate, edge->target);
+                }
+            }
+        }
+        if (meeting == -1) {
+            return false;
+        }
+
+        // Source up to the meeting point, then down to the target, with
+        // every shortcut expanded into the roads it stands for
+        vector<int> up;
+        for (int city = meeting; city != -1; city = parent[0][city]) {
+            up.push_back(city);
+        }
+        reverse(up.begin(), up.end());
+        path.push_back(source);
+        for (size_t i = 0; i + 1 < up.size(); i++) {
+            hierarchy.unpack(up[i], up[i + 1], path);
+        }
+        for (int city = meeting; parent[1][city] != -1; city = parent[1][city]) {
+            hierarchy.unpack(city, parent[1][city], path);
+        }
+        cost = best;
+        return true;
+    }
+};
+
+// Recent route answers by city pair, most recently used first, up to
+// CAPACITY of them. Every change to the network that can alter a route is
+// logged with the epoch it starts; an entry remembers the epoch it was last
+// known to be right at, and on its next lookup is checked against the
+// changes made since. Only the answers a change can affect are dropped:
+//   - a road getting dearer drops the routes that use it;
+//   - a road getting cheaper, or a new road, drops the routes costing more
+//     than it now does, as only those could be beaten by going over it.
+// Renaming or adding a city changes no route and is not logged. Slots are
+// cached rather than names, so renamed cities print correctly.
+class RouteCache {
+private:
+    static const size_t CAPACITY = 256;
+    static const size_t LOG_LIMIT = 4096;  // Entries are brought up to date and the log emptied beyond this
+
+    struct Change {
+        RouteMetric metric;
+        int city1;  // -1: every route of this metric may have changed
+        int city2;
+        double oldWeight;
+        double newWeight;
+    };
+
+    struct Entry {
+        uint64_t key;
+        vector<int> path;  // Empty when no route exists
+        double cost;       // Infinity when no route exists
+        uint64_t epoch;
+    };
+
+    list<Entry> entries;  // Most recently used first
+    unordered_map<uint64_t, list<Entry>::iterator> entryByKey;
+    vector<Change> changes;  // changes[i] starts epoch logStart + i + 1
+    uint64_t epoch;
+    uint64_t logStart;
+    size_t hits;
+    size_t misses;
+    size_t dropped;
+    bool lastHit;
+
+    static uint64_t keyOf(RouteMetric metric, int source, int target) {
+        return (uint64_t)source << 33 | (uint64_t)target << 1 | (metric == RouteMetric::Length ? 1 : 0);
+    }
+
+    static RouteMetric metricOf(uint64_t key) { return key & 1 ? RouteMetric::Length : RouteMetric::Budget; }
+
+    static bool affects(const Change& change, const Entry& entry) {
+        if (change.metric != metricOf(entry.key)) {
+            return false;
+        }
+        if (change.city1 == -1) {
+            return true;
+        }
+        if (change.newWeight < change.oldWeight && entry.cost > change.newWeight) {
+            return true;
+        }
+        for (size_t i = 0; i + 1 < entry.path.size(); i++) {
+            int a = entry.path[i], b = entry.path[i + 1];
+            if ((a == change.city1 && b == change.city2) || (a == change.city2 && b == change.city1)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Checks the entry against the changes logged since it was last
+    // checked; false when it has to be dropped
+    bool bringUpToDate(Entry& entry) const {
+        for (size_t i = entry.epoch - logStart; i < changes.size(); i++) {
+            if (affects(changes[i], entry)) {
+                return false;
+            }
+        }
+        entry.epoch = epoch;
+        return true;
+    }
+
+    void erase(list<Entry>::iterator it) {
+        entryByKey.erase(it->key);
+        entries.erase(it);
+        dropped++;
+    }
+
+    void record(const Change& change) {
+        if (entries.empty()) {
+            epoch++;
+            logStart = epoch;
+            return;
+        }
+        if (changes.size() == LOG_LIMIT) {
+            for (auto it = entries.begin(); it != entries.end();) {
+                auto next = std::next(it);
+                if (!bringUpToDate(*it)) {
+                    erase(it);
+                }
+                it = next;
+            }
+            changes.clear();
+            logStart = epoch;
+        }
+        changes.push_back(change);
+        epoch++;
+    }
+
+public:
+    RouteCache() : epoch(0), logStart(0), hits(0), misses(0), dropped(0), lastHit(false) {}
+
+    uint64_t getEpoch() const { return epoch; }
+    size_t size() const { return entries.size(); }
+    size_t getHits() const { return hits; }
+    size_t getMisses() const { return misses; }
+    size_t getDropped() const { return dropped; }
+    bool lastLookupHit() const { return lastHit; }
+
+    void resetCounters() {
+        hits = 0;
+        misses = 0;
+        dropped = 0;
+    }
+
+    // Copies a cached answer into path and cost. Returns false on a miss.
+    bool lookup(RouteMetric metric, int source, int target, vector<int>& path, double& cost) {
+        lastHit = false;
+        auto found = entryByKey.find(keyOf(metric, source, target));
+        if (found == entryByKey.end()) {
+            misses++;
+            return false;
+        }
+        auto it = found->second;
+        if (!bringUpToDate(*it)) {
+            erase(it);
+            misses++;
+            return false;
+        }
+        entries.splice(entries.begin(), entries, it);
+        path = it->path;
+        cost = it->cost;
+        hits++;
+        lastHit = true;
+        return true;
+    }
+
+    void store(RouteMetric metric, int source, int target, const vector<int>& path, double cost) {
+        uint64_t key = keyOf(metric, source, target);
+        auto found = entryByKey.find(key);
+        if (found != entryByKey.end()) {
+            entries.erase(found->second);
+            entryByKey.erase(found);
+        } else if (entries.size() == CAPACITY) {
+            entryByKey.erase(entries.back().key);
+            entries.pop_back();
+        }
+        if (entries.empty()) {
+            changes.clear();
+            logStart = epoch;
+        }
+        entries.push_front(Entry{key, path, cost, epoch});
+        entryByKey[key] = entries.begin();
+    }
+
+    // A road's weight in the given metric went from oldWeight to newWeight;
+    // pass infinity as oldWeight for a new road or an unknown length
+    void weightChanged(RouteMetric metric, int city1, int city2, double oldWeight, double newWeight) {
+        record(Change{metric, city1, city2, oldWeight, newWeight});
+    }
+
+    // Every route of the metric may have changed (e.g. a city moved)
+    void metricChanged(RouteMetric metric) { record(Change{metric, -1, -1, 0.0, 0.0}); }
+
+    void clear() {
+        dropped += entries.size();
+        entries.clear();
+        entryByKey.clear();
+        changes.clear();
+        epoch++;
+        logStart = epoch;
+    }
+};
+
+// Read-only copy of the network. The query server answers from one of
+// these while the operator keeps editing; a new copy is published after
+// each change and old copies are freed once no query is using them.
+struct NetworkView {
+    uint64_t version = 0;
+    shared_ptr<const NameArena> names;  // Holds the characters of the city names
+    vector<City> cities;
+    RoadGraph roads;
+    vector<int> network;  // Representative slot of each city's road network
+    RouteGeometry geometry;
+    shared_ptr<const ContractionHierarchy> hierarchy;  // Null when not prepared
+    unordered_map<string_view, int, NameHash, equal_to<>> slotByName;
+    unordered_map<int, int> slotByIndex;
+
+    int findCityIndexByName(string_view name) const {
+        auto it = slotByName.find(name);
+        return it == slotByName.end() ? -1 : it->second;
+    }
+};
+
+// Answers read-only queries on a local UNIX socket, one thread per client.
+// Each query line is tab-separated, like batch commands:
+//   info / city <name> / name <index> / roads <name> /
+//   route <city1> <city2> / shortest <city1> <city2> /
+//   connected <city1> <city2> / quit
+// Answers are one line: OK followed by tab-separated fields, or ERROR and
+// a message. Each query takes a reference to the current view, so it never
+// waits for an edit in progress, and an edit never waits for queries.
+class QueryServer {
+private:
+    // Guards only copying and replacing the pointer; views are built
+    // outside it
+    mutable mutex currentLock;
+    shared_ptr<const NetworkView> current;
+    string socketPath;
+    int listenFd;
+    thread acceptThread;
+
+    mutex clientsLock;
+    condition_variable clientsDone;
+    vector<int> clientFds;  // Connections being served
+
+    static void appendNumber(string& out, double value) {
+        char buffer[32];
+        auto result = to_chars(buffer, buffer + sizeof(buffer), value);
+        out.append(buffer, result.ptr);
+    }
+
+    static vector<string_view> splitQuery(string_view line) {
+        vector<string_view> fields;
+        while (true) {
+            size_t tab = line.find('\t');
+            fields.push_back(line.substr(0, tab));
+            if (tab == string_view::npos) {
+                return fields;
+            }
+            line.remove_prefix(tab + 1);
+        }
+    }
+
+    static bool sendAll(int fd, const string& text) {
+        size_t sent = 0;
+        while (sent < text.size()) {
+            ssize_t count = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+            if (count <= 0) {
+                return false;
+            }
+            sent += count;
+        }
+        return true;
+    }
+
+    // Answer to one query line, without the trailing newline
+    static string answer(const NetworkView& view, string_view line, RoutePlanner& planner,
+                         HierarchyQuery& hierarchyQuery, vector<int>& path) {
+        vector<string_view> fields = splitQuery(line);
+        string_view command = fields[0];
+        string out = "OK";
+
+        auto lookup = [&](string_view name, int& slot) {
+            slot = view.findCityIndexByName(name);
+            if (slot == -1) {
+                out = "ERROR\tCity '" + string(name) + "' does not exist";
+                return false;
+            }
+            return true;
+        };
+
+        if (command == "info" && fields.size() == 1) {
+            out += "\t" + to_string(view.version) + "\t" + to_string(view.cities.size()) + "\t" +
+                   to_string(view.roads.getRoadCount());
+        } else if (command == "city" && fields.size() == 2) {
+            int slot;
+            if (lookup(fields[1], slot)) {
+                out += "\t" + to_string(view.cities[slot].getIndex());
+            }
+        } else if (command == "name" && fields.size() == 2) {
+            int index = 0;
+            auto result = from_chars(fields[1].data(), fields[1].data() + fields[1].size(), index);
+            auto it = view.slotByIndex.find(index);
+            if (result.ec != errc() || result.ptr != fields[1].data() + fields[1].size() || it == view.slotByIndex.end()) {
+                return "ERROR\tNo city has index " + string(fields[1]);
+            }
+            out += "\t";
+            out += view.cities[it->second].getName();
+        } else if (command == "roads" && fields.size() == 2) {
+            int slot;
+            if (lookup(fields[1], slot)) {
+                const vector<Road>& list = view.roads.neighbors(slot);
+                out += "\t" + to_string(list.size());
+                for (const Road& road : list) {
+                    out += "\t";
+                    out += view.cities[road.neighbor].getName();
+                    out += "\t";
+                    appendNumber(out, road.budget);
+                }
+            }
+        } else if ((command == "route" || command == "shortest" || command == "connected") && fields.size() == 3) {
+            int from, to;
+            if (lookup(fields[1], from) && lookup(fields[2], to)) {
+                if (command == "connected") {
+                    out += view.network[from] == view.network[to] ? "\tyes" : "\tno";
+                } else {
+                    double cost;
+                    RouteMetric metric = command == "route" ? RouteMetric::Budget : RouteMetric::Length;
+                    bool found = metric == RouteMetric::Budget && view.hierarchy
+                                     ? hierarchyQuery.findRoute(*view.hierarchy, from, to, path, cost)
+                                     : planner.findRoute(view.roads, view.geometry, metric, from, to, path, cost);
+                    if (!found) {
+                        return "ERROR\tNo road route exists between " + string(fields[1]) + " and " + string(fields[2]);
+                    }
+                    out += "\t";
+                    appendNumber(out, cost);
+                    for (int slot : path) {
+                        out += "\t";
+                        out += view.cities[slot].getName();
+                    }
+                }
+            }
+        } else {
+            return "ERROR\tUnknown query '" + string(line) + "'";
+        }
+        return out;
+    }
+
+    void serveClient(int fd) {
+        RoutePlanner planner;  // Search buffers are per client
+        HierarchyQuery hierarchyQuery;
+        vector<int> path;
+        string pending;
+        char buffer[4096];
+        bool open = true;
+        while (open) {
+            ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+            if (count <= 0) {
+                break;
+            }
+            pending.append(buffer, count);
+
+            // Answer every complete line received so far, all in one reply
+            string reply;
+            size_t start = 0, end;
+            while ((end = pending.find('\n', start)) != string::npos) {
+                string_view line(pending.data() + start, end - start);
+                start = end + 1;
+                if (!line.empty() && line.back() == '\r') {
+                    line.remove_suffix(1);
+                }
+                if (line == "quit") {
+                    open = false;
+                    break;
+                }
+                if (!line.empty()) {
+                    shared_ptr<const NetworkView> view = currentView();
+                    reply += answer(*view, line, planner, hierarchyQuery, path);
+                    reply += '\n';
+                }
+            }
+            pending.erase(0, start);
+            if (!sendAll(fd, reply)) {
+                break;
+            }
+        }
+
+        lock_guard<mutex> guard(clientsLock);
+        clientFds.erase(find(clientFds.begin(), clientFds.end(), fd));
+        close(fd);
+        clientsDone.notify_all();
+    }
+
+    void acceptLoop() {
+        while (true) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd == -1) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                return;  // The listening socket was shut down
+            }
+            lock_guard<mutex> guard(clientsLock);
+            clientFds.push_back(fd);
+            thread(&QueryServer::serveClient, this, fd).detach();
+        }
+    }
+
+public:
+    QueryServer() : listenFd(-1) {}
+    ~QueryServer() { stop(); }
+
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+    // Starts answering queries from 'view'. Returns false (with a message
+    // printed) if the socket cannot be created.
+    bool start(const string& path, shared_ptr<const NetworkView> view) {
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path)) {
+            cout << "Socket path " << path << " is too long!" << endl;
+            return false;
+        }
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+        // A socket left behind by a server that did not stop cleanly is
+        // replaced; any other file at the path is never removed
+        struct stat info;
+        if (lstat(path.c_str(), &info) == 0) {
+            if (!S_ISSOCK(info.st_mode)) {
+                cout << path << " already exists and is not a socket; choose another socket path." << endl;
+                return false;
+            }
+            unlink(path.c_str());
+        }
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenFd == -1 || bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 64) != 0) {
+            cout << "Error opening socket " << path << ": " << strerror(errno) << endl;
+            if (listenFd != -1) {
+                close(listenFd);
+                listenFd = -1;
+            }
+            return false;
+        }
+        socketPath = path;
+        publish(move(view));
+        acceptThread = thread(&QueryServer::acceptLoop, this);
+        return true;
+    }
+
+    // Makes 'view' the one new queries see. Queries already running finish
+    // on the view they started with.
+    void publish(shared_ptr<const NetworkView> view) {
+        lock_guard<mutex> guard(currentLock);
+        current.swap(view);
+        // The old view is released after unlocking, or by its last query
+    }
+
+    shared_ptr<const NetworkView> currentView() const {
+        lock_guard<mutex> guard(currentLock);
+        return current;
+    }
+
+    // Stops accepting, disconnects every client and waits for their threads
+    void stop() {
+        if (listenFd == -1) {
+            return;
+        }
+        shutdown(listenFd, SHUT_RDWR);
+        acceptThread.join();
+        close(listenFd);
+        listenFd = -1;
+        unlink(socketPath.c_str());
+
+        unique_lock<mutex> guard(clientsLock);
+        for (int fd : clientFds) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        clientsDone.wait(guard, [this] { return clientFds.empty(); });
+    }
+};
+
+class InfrastructureManagement {
+private:
+    // The benchmark build times private helpers such as findCityIndexByName
+    friend class Benchmark;
+    friend class SelfTest;
+
+    // Owns the characters of every city name; the cities, the name index
+    // and published views all hold handles into it
+    shared_ptr<NameArena> names;
+    vector<City> cities;
+    RoadGraph roads;
+    bool dataLoaded;
+    RoutePlanner routePlanner;
+    vector<int> routeSlots;  // Reused by route queries
+
+    // Bit-packed copy of which cities are joined by a road, used for degree
+    // and shared-neighbor queries. It is built on first use for networks of
+    // up to DENSE_CITY_LIMIT cities (32 MB at the limit) and then kept up to
+    // date by applyAddCity/applyAddRoad; bulk loads mark it stale, and it is
+    // dropped once added cities take the network past the limit.
+    static const size_t DENSE_CITY_LIMIT = 16384;
+    RoadBitMatrix roadBits;
+    bool roadBitsCurrent;
+
+    // Which cities can reach each other by road. Kept up to date by
+    // applyAddCity/applyAddRoad in near-constant time; after a bulk load it
+    // is recomputed in parallel on first use.
+    DisjointSets networks;
+    bool networksCurrent;
+
+    // Roads by budget and per-city budget totals for the analytics queries.
+    // Built on first use and then kept up to date like 'networks'.
+    BudgetIndex budgetIndex;
+    bool budgetsCurrent;
+
+    // Every change is appended to journal.log as it happens; the text files
+    // are only rewritten once the journal has grown past this many entries
+    // (or on exit), after which the journal starts over
+    static const size_t JOURNAL_COMPACT_THRESHOLD = 1000;
+    ofstream journal;
+    size_t journalEntries;
+
+    // Lookup tables from a city's name and public index to its slot in
+    // 'cities'. They must be updated whenever 'cities' changes.
+    unordered_map<string_view, int, NameHash, equal_to<>> slotByName;
+    unordered_map<int, int> slotByIndex;
+    // Largest public index handed out, so deleted ones are not reused. It is
+    // saved with the data, since the highest cities may have been deleted.
+    int highestIndex;
+
+    // Deleting a city only removes its roads and marks its slot; the dead
+    // slots are squeezed out once they make up a quarter of 'cities' (and
+    // number at least TOMBSTONE_COMPACT_MIN), and before anything that
+    // walks every city, such as reports and saves
+    static const size_t TOMBSTONE_COMPACT_MIN = 64;
+    size_t deadCities;
+
+    // Region (province) names by id, as stored in City; id 0 is "no region"
+    static const size_t MAX_REGIONS = 65536;
+    vector<string> regionNames;
+    unordered_map<string, int, NameHash, equal_to<>> regionIds;
+
+    // Storage by region. Once the data is kept under regions/ (see
+    // saveRegions), start-up only reads the directory of cities in
+    // regions/index.txt and the roads between regions in regions/cross.txt.
+    // A region's own cities and roads are loaded the first time one of its
+    // cities is looked up; until then its cities are only in the directory
+    // and roads to them wait in pendingRoads. A road is in 'roads' exactly
+    // when both of its cities are loaded.
+    struct StoredCity {
+        string_view name;
+        int region;
+    };
+    struct PendingRoad {
+        int index1;  // Public indices
+        int index2;
+        double budget;
+        float length;
+    };
+    bool sharded;
+    vector<bool> regionLoaded;
+    unordered_map<int, StoredCity> storedByIndex;  // Cities not loaded yet
+    unordered_map<string_view, int, NameHash, equal_to<>> storedByName;
+    vector<PendingRoad> pendingRoads;
+
+    // Bumped by every change, so the query server knows when to publish a
+    // new view
+    uint64_t version;
+
+    // City positions and A* rates for route searches. Locations, budgets,
+    // lengths and roads all feed into it, so rather than being updated
+    // piecemeal it is rebuilt on the first route query after any change.
+    RouteGeometry geometry;
+    uint64_t geometryVersion;
+
+    // Contraction hierarchy for cheapest-route queries, saved as roads.ch.
+    // Any change to cities, roads or budgets drops it, and routes fall back
+    // to A* until it is prepared again or rebuilt at exit. Shared with
+    // published views.
+    shared_ptr<const ContractionHierarchy> hierarchy;
+    bool hierarchyWanted;  // Set once prepared or loaded; rebuilt at exit
+    HierarchyQuery hierarchyQuery;
+
+    // Answers to recent route queries. The apply* functions tell it what
+    // changed so that it can drop just the answers affected.
+    RouteCache routeCache;
+
+    // Call counts and latencies of the main operations (see OperationStats).
+    // Mutable so that const lookups can be timed too.
+    mutable OperationStats stats;
+
+    // Helper functions
+    // Loads the city's region first if it is still on disk
+    int findCityIndexByName(string_view cityName) {
+        {
+            auto timer = stats.time(Operation::FindCityByName);
+            int slot = findSlotByName(cityName);
+            if (slot != -1 || storedByName.empty()) {
+                return slot;
+            }
+        }
+        auto stored = storedByName.find(cityName);
+        if (stored == storedByName.end()) {
+            return -1;
+        }
+        loadRegion(storedByIndex[stored->second].region);
+        return findSlotByName(cityName);
+    }
+
+    // Untimed lookup, safe to call from several threads at once
+    int findSlotByName(string_view cityName) const {
+        auto it = slotByName.find(cityName);
+        return it == slotByName.end() ? -1 : it->second;
+    }
+
+    // "City1-City2", as roads are shown in reports
+    string roadName(int idx1, int idx2) const {
+        string name(cities[idx1].getName());
+        name += '-';
+        name += cities[idx2].getName();
+        return name;
+    }
+
+    int findCityIndexByIndex(int index) {
+        auto it = slotByIndex.find(index);
+        if (it != slotByIndex.end()) {
+            return it->second;
+        }
+        auto stored = storedByIndex.find(index);
+        if (stored == storedByIndex.end()) {
+            return -1;
+        }
+        loadRegion(stored->second.region);
+        it = slotByIndex.find(index);
+        return it == slotByIndex.end() ? -1 : it->second;
+    }
+
+    void resetRegions() {
+        regionNames.assign(1, "");
+        regionIds.clear();
+        regionIds.emplace("", 0);
+        regionLoaded.assign(1, true);
+    }
+
+    // Id of the named region, which is added if it is new; -1 when there
+    // are already MAX_REGIONS
+    int regionId(string_view name) {
+        auto it = regionIds.find(name);
+        if (it != regionIds.end()) {
+            return it->second;
+        }
+        if (regionNames.size() == MAX_REGIONS) {
+            return -1;
+        }
+        regionNames.emplace_back(name);
+        regionIds.emplace(regionNames.back(), regionNames.size() - 1);
+        regionLoaded.push_back(true);  // A new region has nothing on disk
+        return checkedCast<int>(regionNames.size() - 1);
+    }
+
+    // Registers the city stored at 'slot' in the lookup tables. If the name
+    // or index is already taken the first city keeps it.
+    void indexCity(int slot) {
+        slotByName.emplace(cities[slot].getName(), slot);
+        slotByIndex.emplace(cities[slot].getIndex(), slot);
+        highestIndex = max(highestIndex, cities[slot].getIndex());
+    }
+
+    void rebuildCityIndex() {
+        slotByName.clear();
+        slotByIndex.clear();
+        slotByName.reserve(cities.size());
+        slotByIndex.reserve(cities.size());
+        for (size_t i = 0; i < cities.size(); i++) {
+            if (!cities[i].isDeleted()) {
+                indexCity(checkedCast<int>(i));
+            }
+        }
+    }
+
+    // Renders one row of an adjacency matrix. Only the roads of the city are
+    // visited; the cells in between are known to be empty.
+    void renderRoadRow(TextBuffer& out, size_t row) const {
+        const vector<Road>& list = roads.neighbors(row);
+        size_t next = 0;
+        for (size_t j = 0; j < cities.size(); j++) {
+            int cell = 0;
+            if (next < list.size() && list[next].neighbor == (int)j) {
+                cell = 1;
+                next++;
+            }
+            out.padLeft(cell, 4);
+        }
+    }
+
+    void renderBudgetRow(TextBuffer& out, size_t row) const {
+        const vector<Road>& list = roads.neighbors(row);
+        size_t next = 0;
+        for (size_t j = 0; j < cities.size(); j++) {
+            double cell = 0.0;
+            if (next < list.size() && list[next].neighbor == (int)j) {
+                cell = list[next].budget;
+                next++;
+            }
+            out.padLeft(cell, 7, 1);
+        }
+    }
+
+    void renderCities(TextBuffer& out) const {
+        out.divider('=', 60);
+        out.title("CITIES LIST", '=', 60);
+        out.divider('-', 60);
+        
+        // Regions get a column once any city has one
+        bool withRegions = regionNames.size() > 1;
+        out.padLeft("INDEX", 10).padLeft("CITY NAME", 30);
+        if (withRegions) {
+            out.padLeft("REGION", 20);
+        }
+        out.newline();
+        out.divider('-', 60);
+        
+        for (const auto& city : cities) {
+            out.padLeft(city.getIndex(), 10).padLeft(city.getName(), 30);
+            if (withRegions) {
+                out.padLeft(regionLabel(city.getRegion()), 20);
+            }
+            out.newline();
+        }
+        
+        out.divider('=', 60);
+    }
+
+    void renderRoadMatrix(TextBuffer& out) const {
+        out.divider('=', 60);
+        out.title("ROADS ADJACENCY MATRIX", '=', 60);
+        out.divider('-', 60);
+        
+        // Column headers (city indices)
+        out.padLeft(" ", 6);
+        for (const auto& city : cities) {
+            out.padLeft(city.getIndex(), 4);
+        }
+        out.newline();
+        
+        out.divider('-', 60);
+        
+        // Matrix with row headers
+        for (size_t i = 0; i < cities.size(); i++) {
+            out.padLeft(cities[i].getIndex(), 4).append(" |");
+            renderRoadRow(out, i);
+            out.newline();
+        }
+        
+        out.divider('=', 60);
+    }
+
+    void renderBudgetMatrix(TextBuffer& out) const {
+        out.title("BUDGETS ADJACENCY MATRIX (Billion RWF)", '=', 60);
+        out.divider('-', 60);
+        
+        // Column headers (city indices)
+        out.padLeft(" ", 6);
+        for (const auto& city : cities) {
+            out.padLeft(city.getIndex(), 7);
+        }
+        out.newline();
+        
+        out.divider('-', 60);
+        
+        // Matrix with row headers
+        for (size_t i = 0; i < cities.size(); i++) {
+            out.padLeft(cities[i].getIndex(), 4).append(" |");
+            renderBudgetRow(out, i);
+            out.newline();
+        }
+        
+        out.divider('=', 60);
+    }
+
+    // Roads listed one per line, as in roads.txt. Unlike the matrices its
+    // size grows with the number of roads, not the square of the cities.
+    void renderRoadList(TextBuffer& out) const {
+        out.divider('=', 60);
+        out.title("ROADS LIST", '=', 60);
+        out.divider('-', 60);
+        
+        out.padLeft("NBR", 6).padLeft("ROAD", 36).padLeft("BUDGET", 16).newline();
+        out.divider('-', 60);
+        
+        int roadNumber = 0;
+        for (size_t i = 0; i < cities.size(); i++) {
+            for (const Road& road : roads.neighbors(i)) {
+                if (road.neighbor > (int)i) {
+                    roadNumber++;
+                    string_view name1 = cities[i].getName();
+                    string_view name2 = cities[road.neighbor].getName();
+                    out.padLeft(roadNumber, 6);
+                    out.padding(36 - (int)(name1.size() + 1 + name2.size()));
+                    out.append(name1).append("-").append(name2);
+                    out.padLeft(road.budget, 16, 2).newline();
+                }
+            }
+        }
+        
+        out.divider('-', 60);
+        out.append("Total roads: ").append(roadNumber).newline();
+        out.divider('=', 60);
+    }
+
+    // State changes shared by the menu actions and journal replay. Callers
+    // validate the arguments first.
+    int applyAddCity(string_view name, int index) {
+        version++;
+        hierarchy.reset();
+        cities.push_back(City(index, names->store(name)));
+        indexCity(checkedCast<int>(cities.size() - 1));
+        
+        // Give the new city an (empty) list of roads
+        roads.resize(cities.size());
+        if (roadBitsCurrent) {
+            if (cities.size() > DENSE_CITY_LIMIT) {
+                // Too large to keep densely; queries use the road lists
+                roadBits = RoadBitMatrix();
+                roadBitsCurrent = false;
+            } else {
+                roadBits.addCity(DENSE_CITY_LIMIT);
+            }
+        }
+        if (networksCurrent) {
+            networks.addElement();
+        }
+        if (budgetsCurrent) {
+            budgetIndex.addCity();
+        }
+        return index;
+    }
+
+    bool applyAddRoad(int idx1, int idx2) {
+        // Add road in both directions (undirected graph)
+        if (!roads.addRoad(idx1, idx2)) {
+            return false;
+        }
+        version++;
+        hierarchy.reset();
+        routeCache.weightChanged(RouteMetric::Budget, idx1, idx2, numeric_limits<double>::infinity(), 0.0);
+        routeCache.weightChanged(RouteMetric::Length, idx1, idx2, numeric_limits<double>::infinity(), 0.0);
+        if (roadBitsCurrent) {
+            roadBits.set(idx1, idx2);
+            roadBits.set(idx2, idx1);
+        }
+        if (networksCurrent) {
+            networks.unite(idx1, idx2);
+        }
+        if (budgetsCurrent) {
+            budgetIndex.addRoad(idx1, idx2, 0.0);
+        }
+        return true;
+    }
+
+    // Called after the road graph is replaced wholesale (file loads)
+    void roadsReplaced() {
+        version++;
+        hierarchy.reset();
+        routeCache.clear();
+        roadBitsCurrent = false;
+        networksCurrent = false;
+        budgetsCurrent = false;
+    }
+
+    // Answers from the route cache when it can. Otherwise cheapest routes
+    // use the contraction hierarchy when there is a current one; other
+    // routes, and cheapest ones without it, use A*.
+    bool planRoute(RouteMetric metric, int source, int target, double& total) {
+        if (routeCache.lookup(metric, source, target, routeSlots, total)) {
+            return !routeSlots.empty();
+        }
+        bool found;
+        if (metric == RouteMetric::Budget && hierarchy) {
+            found = hierarchyQuery.findRoute(*hierarchy, source, target, routeSlots, total);
+        } else {
+            found = routePlanner.findRoute(roads, ensureGeometry(), metric, source, target, routeSlots, total);
+        }
+        if (!found) {
+            routeSlots.clear();
+            total = numeric_limits<double>::infinity();
+        }
+        routeCache.store(metric, source, target, routeSlots, total);
+        return found;
+    }
+
+    const RouteGeometry& ensureGeometry() {
+        if (geometryVersion != version) {
+            geometry.build(cities, roads);
+            geometryVersion = version;
+        }
+        return geometry;
+    }
+
+    void ensureBudgetIndex() {
+        if (!budgetsCurrent) {
+            budgetIndex.build(roads);
+            budgetsCurrent = true;
+        }
+    }
+
+    void ensureNetworks() {
+        if (!networksCurrent) {
+            vector<int> label;
+            labelComponents(roads, label);
+            networks.assignLabels(label);
+            networksCurrent = true;
+        }
+    }
+
+    // Builds the bit matrix if it is stale. Returns false for networks too
+    // large to keep densely; callers then work from the road lists.
+    bool ensureRoadBits() {
+        if (!roadBitsCurrent) {
+            if (cities.size() > DENSE_CITY_LIMIT) {
+                return false;
+            }
+            roadBits.build(roads);
+            roadBitsCurrent = true;
+        }
+        return true;
+    }
+
+    void applyAddBudget(int idx1, int idx2, double budget) {
+        // Add budget in both directions (undirected graph)
+        version++;
+        hierarchy.reset();
+        routeCache.weightChanged(RouteMetric::Budget, idx1, idx2, roads.getBudget(idx1, idx2), budget);
+        if (budgetsCurrent) {
+            budgetIndex.changeBudget(idx1, idx2, roads.getBudget(idx1, idx2), budget);
+        }
+        roads.setBudget(idx1, idx2, budget);
+    }
+
+    void applySetLocation(int idx, double latitude, double longitude) {
+        version++;
+        // Roads without a recorded length are as long as the distance
+        // between their cities
+        routeCache.metricChanged(RouteMetric::Length);
+        cities[idx].setLocation(latitude, longitude);
+    }
+
+    void applySetLength(int idx1, int idx2, float length) {
+        version++;
+        float oldLength = roads.getLength(idx1, idx2);  // 0 when unknown
+        routeCache.weightChanged(RouteMetric::Length, idx1, idx2,
+                                 oldLength > 0 ? oldLength : numeric_limits<double>::infinity(), length);
+        roads.setLength(idx1, idx2, length);
+    }
+
+    void applyEditCity(int idx, string_view newName) {
+        version++;
+        auto oldEntry = slotByName.find(cities[idx].getName());
+        if (oldEntry != slotByName.end() && oldEntry->second == idx) {
+            slotByName.erase(oldEntry);
+        }
+        cities[idx].setName(names->store(newName));
+        slotByName.emplace(cities[idx].getName(), idx);
+    }
+
+    void applySetRegion(int idx, int region) {
+        version++;
+        cities[idx].setRegion(region);
+    }
+
+    // Removes one road, leaving the cities in place
+    void applyDeleteRoad(int idx1, int idx2) {
+        version++;
+        hierarchy.reset();
+        double budget = roads.getBudget(idx1, idx2);
+        float length = roads.getLength(idx1, idx2);
+        routeCache.weightChanged(RouteMetric::Budget, idx1, idx2, budget, numeric_limits<double>::infinity());
+        routeCache.weightChanged(RouteMetric::Length, idx1, idx2, length, numeric_limits<double>::infinity());
+        roads.removeRoad(idx1, idx2);
+        if (roadBitsCurrent) {
+            roadBits.unset(idx1, idx2);
+            roadBits.unset(idx2, idx1);
+        }
+        // A removed road can split a network, which the disjoint sets
+        // cannot undo
+        networksCurrent = false;
+        if (budgetsCurrent) {
+            budgetIndex.removeRoad(idx1, idx2, budget);
+        }
+    }
+
+    // Removes a city's roads and turns its slot into a tombstone, in time
+    // proportional to its roads. Other cities keep their slots until the
+    // next compaction.
+    void applyDeleteCity(int idx) {
+        loadNeighborRegions(idx);  // So that every road of the city is in 'roads'
+        version++;
+        vector<Road> list = roads.neighbors(idx);
+        for (const Road& road : list) {
+            applyDeleteRoad(idx, road.neighbor);
+        }
+        slotByName.erase(cities[idx].getName());
+        slotByIndex.erase(cities[idx].getIndex());
+        cities[idx].markDeleted();
+        deadCities++;
+        if (deadCities >= TOMBSTONE_COMPACT_MIN && deadCities * 4 >= cities.size()) {
+            compactCities();
+        }
+    }
+
+    // Squeezes the tombstones out of 'cities' and the road lists. Every
+    // slot after the first dead one moves, so everything keyed by slot is
+    // rebuilt or dropped, as after a load.
+    void compactCities() {
+        if (deadCities == 0) {
+            return;
+        }
+        auto timer = stats.time(Operation::CompactCities);
+        vector<int> newSlot(cities.size(), -1);
+        size_t kept = 0;
+        for (size_t i = 0; i < cities.size(); i++) {
+            if (!cities[i].isDeleted()) {
+                newSlot[i] = checkedCast<int>(kept);
+                cities[kept++] = cities[i];
+            }
+        }
+        cities.erase(cities.begin() + kept, cities.end());
+        roads.renumber(newSlot, kept);
+        deadCities = 0;
+        rebuildCityIndex();
+        roadsReplaced();
+    }
+
+    // Checks shared by the menu actions and batch mode. They return an empty
+    // string when the change can be made, or the message explaining why not.
+    // Looking a city up loads its region if needed, so they are not const.
+    string checkDeleteCity(string_view name, int& idx) {
+        idx = findCityIndexByName(name);
+        if (idx == -1) {
+            return "City '" + string(name) + "' does not exist!";
+        }
+        return "";
+    }
+
+    string checkDeleteRoad(string_view city1, string_view city2, int& idx1, int& idx2) {
+        idx1 = findCityIndexByName(city1);
+        idx2 = findCityIndexByName(city2);
+        
+        if (idx1 == -1) {
+            return "City '" + string(city1) + "' does not exist!";
+        }
+        if (idx2 == -1) {
+            return "City '" + string(city2) + "' does not exist!";
+        }
+        if (!roads.hasRoad(idx1, idx2)) {
+            return "No road exists between " + string(city1) + " and " + string(city2) + "!";
+        }
+        return "";
+    }
+
+    // Journal records are tab-separated lines, so names cannot hold tabs
+    // or line breaks
+    static bool hasSeparator(string_view name) {
+        return name.find_first_of("\t\r\n") != string_view::npos;
+    }
+
+    string checkRegion(string_view city, string_view region, int& idx) {
+        idx = findCityIndexByName(city);
+        if (idx == -1) {
+            return "City '" + string(city) + "' does not exist!";
+        }
+        if (region.empty()) {
+            return "Region name cannot be empty.";
+        }
+        if (hasSeparator(region)) {
+            return "Region name cannot contain tabs or line breaks.";
+        }
+        if (regionIds.find(region) == regionIds.end() && regionNames.size() == MAX_REGIONS) {
+            return "Too many regions.";
+        }
+        return "";
+    }
+
+    string checkNewCity(string_view name) {
+        if (hasSeparator(name)) {
+            return "City name cannot contain tabs or line breaks.";
+        }
+        if (findCityIndexByName(name) != -1) {
+            return "City '" + string(name) + "' already exists!";
+        }
+        return "";
+    }
+
+    string checkLocation(string_view city, double latitude, double longitude, int& idx) {
+        idx = findCityIndexByName(city);
+        if (idx == -1) {
+            return "City '" + string(city) + "' does not exist!";
+        }
+        if (!(latitude >= -90.0 && latitude <= 90.0) || !(longitude >= -180.0 && longitude <= 180.0)) {
+            return "Latitude must be between -90 and 90 and longitude between -180 and 180.";
+        }
+        return "";
+    }
+
+    string checkLength(string_view city1, string_view city2, double length, int& idx1, int& idx2) {
+        idx1 = findCityIndexByName(city1);
+        idx2 = findCityIndexByName(city2);
+        
+        if (idx1 == -1) {
+            return "City '" + string(city1) + "' does not exist!";
+        }
+        if (idx2 == -1) {
+            return "City '" + string(city2) + "' does not exist!";
+        }
+        if (!roads.hasRoad(idx1, idx2)) {
+            return "No road exists between " + string(city1) + " and " + string(city2) + "!";
+        }
+        if (!(length > 0.0 && length < 1e6)) {
+            return "Length must be a positive number of km.";
+        }
+        return "";
+    }
+
+    string checkRoad(string_view city1, string_view city2, int& idx1, int& idx2) {
+        idx1 = findCityIndexByName(city1);
+        idx2 = findCityIndexByName(city2);
+        
+        if (idx1 == -1) {
+            return "City '" + string(city1) + "' does not exist!";
+        }
+        if (idx2 == -1) {
+            return "City '" + string(city2) + "' does not exist!";
+        }
+        if (idx1 == idx2) {
+            return "Cannot add a road between the same city!";
+        }
+        if (roads.hasRoad(idx1, idx2)) {
+            return "A road already exists between " + string(city1) + " and " + string(city2) + "!";
+        }
+        return "";
+    }
+
+    string checkBudget(string_view city1, string_view city2, int& idx1, int& idx2) {
+        idx1 = findCityIndexByName(city1);
+        idx2 = findCityIndexByName(city2);
+        
+        if (idx1 == -1) {
+            return "City '" + string(city1) + "' does not exist!";
+        }
+        if (idx2 == -1) {
+            return "City '" + string(city2) + "' does not exist!";
+        }
+        if (!roads.hasRoad(idx1, idx2)) {
+            return "No road exists between " + string(city1) + " and " + string(city2) + "!\n" +
+                   "Please add a road first before assigning a budget.";
+        }
+        return "";
+    }
+
+    string checkEdit(int index, string_view newName, int& idx) {
+        idx = findCityIndexByIndex(index);
+        if (idx == -1) {
+            return "No city found with index " + to_string(index);
+        }
+        if (hasSeparator(newName)) {
+            return "City name cannot contain tabs or line breaks.";
+        }
+        
+        // Check if the new name already exists
+        int existingIdx = findCityIndexByName(newName);
+        if (existingIdx != -1 && existingIdx != idx) {
+            return "City '" + string(newName) + "' already exists!";
+        }
+        return "";
+    }
+
+    // Makes sure 'count' cities fit without further reallocation. Capacity
+    // at least doubles whenever it grows, so adding cities in many small
+    // groups still costs linear time overall.
+    void ensureCityCapacity(size_t count) {
+        if (count <= cities.capacity()) {
+            return;
+        }
+        size_t capacity = max(count, cities.capacity() * 2);
+        cities.reserve(capacity);
+        slotByName.reserve(capacity);
+        slotByIndex.reserve(capacity);
+        roads.reserve(capacity);
+    }
+
+    // One batch command, applied without journaling (the batch is saved as a
+    // whole at the end). Returns an error message, or "" on success.
+    string applyBatchCommand(string_view line) {
+        vector<string_view> fields;
+        while (true) {
+            size_t tab = line.find('\t');
+            fields.push_back(line.substr(0, tab));
+            if (tab == string_view::npos) {
+                break;
+            }
+            line.remove_prefix(tab + 1);
+        }
+        string_view command = fields[0];
+        
+        if (command == "city" && fields.size() == 2) {
+            if (fields[1].empty()) {
+                return "City name cannot be empty.";
+            }
+            string error = checkNewCity(fields[1]);
+            if (error.empty()) {
+                applyAddCity(fields[1], nextCityIndex());
+            }
+            return error;
+        }
+        
+        if (command == "road" && fields.size() == 3) {
+            int idx1, idx2;
+            string error = checkRoad(fields[1], fields[2], idx1, idx2);
+            if (error.empty()) {
+                applyAddRoad(idx1, idx2);
+            }
+            return error;
+        }
+        
+        if (command == "budget" && fields.size() == 4) {
+            double budget;
+            string_view amount = fields[3];
+            if (!consumeDouble(amount, budget) || !amount.empty() || budget <= 0) {
+                return "Budget must be a positive number.";
+            }
+            int idx1, idx2;
+            string error = checkBudget(fields[1], fields[2], idx1, idx2);
+            if (error.empty()) {
+                applyAddBudget(idx1, idx2, budget);
+            }
+            return error;
+        }
+        
+        if (command == "location" && fields.size() == 4) {
+            double latitude, longitude;
+            string_view lat = fields[2], lon = fields[3];
+            if (!consumeDouble(lat, latitude) || !lat.empty() || !consumeDouble(lon, longitude) || !lon.empty()) {
+                return "Latitude and longitude must be numbers.";
+            }
+            int idx;
+            string error = checkLocation(fields[1], latitude, longitude, idx);
+            if (error.empty()) {
+                applySetLocation(idx, latitude, longitude);
+            }
+            return error;
+        }
+        
+        if (command == "length" && fields.size() == 4) {
+            double length;
+            string_view km = fields[3];
+            if (!consumeDouble(km, length) || !km.empty()) {
+                return "Length must be a positive number of km.";
+            }
+            int idx1, idx2;
+            string error = checkLength(fields[1], fields[2], length, idx1, idx2);
+            if (error.empty()) {
+                applySetLength(idx1, idx2, static_cast<float>(length));
+            }
+            return error;
+        }
+        
+        if (command == "edit" && fields.size() == 3) {
+            int index;
+            string_view number = fields[1];
+            if (!consumeInt(number, index) || !number.empty()) {
+                return "Invalid index. Please enter a number.";
+            }
+            if (fields[2].empty()) {
+                return "City name cannot be empty.";
+            }
+            int idx;
+            string error = checkEdit(index, fields[2], idx);
+            if (error.empty()) {
+                applyEditCity(idx, fields[2]);
+            }
+            return error;
+        }
+        
+        if (command == "region" && fields.size() == 3) {
+            int idx;
+            string error = checkRegion(fields[1], fields[2], idx);
+            if (error.empty()) {
+                applySetRegion(idx, regionId(fields[2]));
+            }
+            return error;
+        }
+        
+        if (command == "delete-city" && fields.size() == 2) {
+            int idx;
+            string error = checkDeleteCity(fields[1], idx);
+            if (error.empty()) {
+                applyDeleteCity(idx);
+            }
+            return error;
+        }
+        
+        if (command == "delete-road" && fields.size() == 3) {
+            int idx1, idx2;
+            string error = checkDeleteRoad(fields[1], fields[2], idx1, idx2);
+            if (error.empty()) {
+                applyDeleteRoad(idx1, idx2);
+            }
+            return error;
+        }
+        
+        return "unknown command or wrong number of fields";
+    }
+
+    int nextCityIndex() const {
+        return highestIndex + 1;
+    }
+
+    // Journal records are tab-separated lines that refer to cities by their
+    // public index, which never changes:
+    //   CITY <index> <name> / ROAD <index1> <index2> /
+    //   BUDGET <index1> <index2> <budget> / EDIT <index> <new name> /
+    //   LOCATION <index> <latitude> <longitude> / LENGTH <index1> <index2> <km> /
+    //   DELETECITY <index> / DELETEROAD <index1> <index2> /
+    //   REGION <index> <region name>
+    void appendToJournal(const string& record) {
+        if (!journal.is_open()) {
+            journal.open("journal.log", ios::app);
+            if (!journal.is_open()) {
+                cout << "Error opening journal.log for writing!" << endl;
+                return;
+            }
+        }
+        journal << record << '\n';
+        journal.flush();
+        journalEntries++;
+    }
+
+    static string formatExact(double value) {
+        // Shortest text that reads back as exactly the same double
+        char buffer[32];
+        auto result = to_chars(buffer, buffer + sizeof(buffer), value);
+        return string(buffer, result.ptr);
+    }
+
+    static string formatBudget(double value) {
+        // Two decimals as before when they read back exactly, else the
+        // exact text, so that roads.txt never rounds a budget
+        char buffer[64];
+        auto result = to_chars(buffer, buffer + sizeof(buffer), value, chars_format::fixed, 2);
+        double back = 0.0;
+        if (result.ec == errc() && from_chars(buffer, result.ptr, back).ec == errc() && back == value) {
+            return string(buffer, result.ptr);
+        }
+        return formatExact(value);
+    }
+
+    static vector<string> splitFields(const string& line, char separator) {
+        vector<string> fields;
+        size_t start = 0;
+        while (true) {
+            size_t end = line.find(separator, start);
+            if (end == string::npos) {
+                fields.push_back(line.substr(start));
+                return fields;
+            }
+            fields.push_back(line.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+
+    static bool parseInt(const string& text, int& value) {
+        auto result = from_chars(text.data(), text.data() + text.size(), value);
+        return result.ec == errc() && result.ptr == text.data() + text.size();
+    }
+
+    static bool parseDouble(const string& text, double& value) {
+        auto result = from_chars(text.data(), text.data() + text.size(), value);
+        return result.ec == errc() && result.ptr == text.data() + text.size();
+    }
+
+    // Applies one journal record. Records that are already reflected in the
+    // loaded data are accepted without changing anything, so a journal left
+    // behind by an interrupted compaction can be replayed over newer files.
+    bool replayRecord(const string& line) {
+        vector<string> fields = splitFields(line, '\t');
+        const string& kind = fields[0];
+        
+        if (kind == "CITY" && fields.size() == 3) {
+            int index;
+            if (!parseInt(fields[1], index)) {
+                return false;
+            }
+            if (findCityIndexByIndex(index) == -1 && findCityIndexByName(fields[2]) == -1) {
+                applyAddCity(fields[2], index);
+            }
+            return true;
+        }
+        
+        if ((kind == "ROAD" && fields.size() == 3) || (kind == "BUDGET" && fields.size() == 4)) {
+            int index1, index2;
+            if (!parseInt(fields[1], index1) || !parseInt(fields[2], index2)) {
+                return false;
+            }
+            int idx1 = findCityIndexByIndex(index1);
+            int idx2 = findCityIndexByIndex(index2);
+            if (idx1 == -1 || idx2 == -1 || idx1 == idx2) {
+                return false;
+            }
+            if (kind == "ROAD") {
+                applyAddRoad(idx1, idx2);
+                return true;
+            }
+            double budget;
+            if (!parseDouble(fields[3], budget) || !roads.hasRoad(idx1, idx2)) {
+                return false;
+            }
+            applyAddBudget(idx1, idx2, budget);
+            return true;
+        }
+        
+        if (kind == "LOCATION" && fields.size() == 4) {
+            int index;
+            double latitude, longitude;
+            if (!parseInt(fields[1], index) || !parseDouble(fields[2], latitude) || !parseDouble(fields[3], longitude)) {
+                return false;
+            }
+            int idx = findCityIndexByIndex(index);
+            if (idx == -1) {
+                return false;
+            }
+            applySetLocation(idx, latitude, longitude);
+            return true;
+        }
+        
+        if (kind == "LENGTH" && fields.size() == 4) {
+            int index1, index2;
+            double length;
+            if (!parseInt(fields[1], index1) || !parseInt(fields[2], index2) || !parseDouble(fields[3], length)) {
+                return false;
+            }
+            int idx1 = findCityIndexByIndex(index1);
+            int idx2 = findCityIndexByIndex(index2);
+            if (idx1 == -1 || idx2 == -1 || !roads.hasRoad(idx1, idx2)) {
+                return false;
+            }
+            applySetLength(idx1, idx2, static_cast<float>(length));
+            return true;
+        }
+        
+        if (kind == "EDIT" && fields.size() == 3) {
+            int index;
+            if (!parseInt(fields[1], index)) {
+                return false;
+            }
+            int idx = findCityIndexByIndex(index);
+            int existingIdx = findCityIndexByName(fields[2]);
+            if (idx == -1 || (existingIdx != -1 && existingIdx != idx)) {
+                return false;
+            }
+            applyEditCity(idx, fields[2]);
+            return true;
+        }
+        
+        if (kind == "REGION" && fields.size() == 3) {
+            int index;
+            if (!parseInt(fields[1], index) || fields[2].empty()) {
+                return false;
+            }
+            int idx = findCityIndexByIndex(index);
+            int region = regionId(fields[2]);
+            if (idx == -1 || region == -1) {
+                return false;
+            }
+            applySetRegion(idx, region);
+            return true;
+        }
+        
+        if (kind == "DELETECITY" && fields.size() == 2) {
+            int index;
+            if (!parseInt(fields[1], index)) {
+                return false;
+            }
+            int idx = findCityIndexByIndex(index);
+            if (idx != -1) {
+                applyDeleteCity(idx);
+            }
+            return true;
+        }
+        
+        if (kind == "DELETEROAD" && fields.size() == 3) {
+            int index1, index2;
+            if (!parseInt(fields[1], index1) || !parseInt(fields[2], index2)) {
+                return false;
+            }
+            int idx1 = findCityIndexByIndex(index1);
+            int idx2 = findCityIndexByIndex(index2);
+            if (idx1 != -1 && idx2 != -1 && roads.hasRoad(idx1, idx2)) {
+                applyDeleteRoad(idx1, idx2);
+            }
+            return true;
+        }
+        
+        return false;
+    }
+
+    void replayJournal() {
+        auto timer = stats.time(Operation::ReplayJournal);
+        ifstream file("journal.log");
+        
+        if (!file.is_open()) {
+            return;
+        }
+        
+        string line;
+        size_t lineNumber = 0;
+        size_t replayed = 0;
+        off_t completeBytes = 0;
+        bool incomplete = false;
+        while (getline(file, line)) {
+            // A last line without a newline was cut off while being written
+            if (file.eof()) {
+                cout << "Ignoring incomplete journal entry on line " << lineNumber + 1 << endl;
+                incomplete = true;
+                break;
+            }
+            lineNumber++;
+            completeBytes += line.size() + 1;
+            if (line.empty()) {
+                continue;
+            }
+            if (replayRecord(line)) {
+                replayed++;
+            } else {
+                cout << "Skipping invalid journal entry on line " << lineNumber << endl;
+            }
+        }
+        
+        file.close();
+        // Drop the cut-off entry so the next record starts on its own line
+        if (incomplete && truncate("journal.log", completeBytes) != 0) {
+            cout << "Error removing the incomplete entry from journal.log!" << endl;
+        }
+        journalEntries = lineNumber;
+        if (replayed > 0) {
+            cout << replayed << " journaled changes replayed from journal.log" << endl;
+        }
+    }
+
+public:
+    // Statistics are collected from the start, including the initial load,
+    // when 'collectStatistics' is set
+    explicit InfrastructureManagement(bool collectStatistics = false) : names(make_shared<NameArena>()), dataLoaded(false), roadBitsCurrent(false), networksCurrent(false), budgetsCurrent(false), journalEntries(0), highestIndex(0), deadCities(0), sharded(false), version(0),
+                                 geometryVersion(numeric_limits<uint64_t>::max()), hierarchyWanted(false) {
+        stats.setEnabled(collectStatistics);
+        // Try to load data from files on initialization
+        loadDataFromFiles();
+    }
+
+    void addCity(string name) {
+        auto timer = stats.time(Operation::AddCity);
+        string error = checkNewCity(name);
+        if (!error.empty()) {
+            cout << error << endl;
+            return;
+        }
+        
+        // Assign the next available index
+        int nextIndex = applyAddCity(name, nextCityIndex());
+        appendToJournal("CITY\t" + to_string(nextIndex) + "\t" + name);
+        
+        cout << "City '" << name << "' added with index " << nextIndex << endl;
+    }
+
+    // Adds every name in 'cityNames' (any range of strings) as a new city.
+    // Storage is grown once for the whole group.
+    template <typename Range>
+    void addCities(const Range& cityNames) {
+        ensureCityCapacity(cities.size() + distance(begin(cityNames), end(cityNames)));
+        for (const auto& name : cityNames) {
+            addCity(name);
+        }
+    }
+
+    void addRoad(string city1, string city2) {
+        auto timer = stats.time(Operation::AddRoad);
+        int idx1, idx2;
+        string error = checkRoad(city1, city2, idx1, idx2);
+        if (!error.empty()) {
+            cout << error << endl;
+            return;
+        }
+        
+        applyAddRoad(idx1, idx2);
+        appendToJournal("ROAD\t" + to_string(cities[idx1].getIndex()) + "\t" + to_string(cities[idx2].getIndex()));
+        
+        cout << "Road added between " << city1 << " and " << city2 << endl;
+    }
+
+    void addBudget(string city1, string city2, double budget) {
+        auto timer = stats.time(Operation::AddBudget);
+        int idx1, idx2;
+        string error = checkBudget(city1, city2, idx1, idx2);
+        if (!error.empty()) {
+            cout << error << endl;
+            return;
+        }
+        
+        applyAddBudget(idx1, idx2, budget);
+        appendToJournal("BUDGET\t" + to_string(cities[idx1].getIndex()) + "\t" + to_string(cities[idx2].getIndex()) +
+                        "\t" + formatExact(budget));
+        
+        cout << "Budget added for the road between " << city1 << " and " << city2 << endl;
+    }
+
+    void setCityLocation(const string& city, double latitude, double longitude) {
+        int idx;
+        string error = checkLocation(city, latitude, longitude, idx);
+        if (!error.empty()) {
+            cout << error << endl;
+            return;
+        }
+        
+        applySetLocation(idx, latitude, longitude);
+        appendToJournal("LOCATION\t" + to_string(cities[idx].getIndex()) + "\t" + formatExact(latitude) + "\t" +
+                        formatExact(longitude));
+        cout << "Location of " << city << " set" << endl;
+    }
+
+    void setRoadLength(const string& city1, const string& city2, double length) {
+        int idx1, idx2;
+        string error = checkLength(city1, city2, length, idx1, idx2);
+        if (!error.empty()) {
+            cout << error << endl;
+            return;
+        }
+        
+        applySetLength(idx1, idx2, static_cast<float>(length));
+        appendToJournal("LENGTH\t" + to_string(cities[idx1].getIndex()) + "\t" + to_string(cities[idx2].getIndex()) +
+                        "\t" + formatExact(roads.getLength(idx1, idx2)));
+        cout << "Length of the road between " << city1 << " and " << city2 << " set" << endl;
+    }
+
+    void editCity(int index, string newName) {
+        auto timer = stats.time(Operation::EditCity);
+        int idx;
+        string error = checkEdit(index, newName, idx);
+        if (!error.empty()) {
+            cout << error << endl;
+            return;
+        }
+        
+        applyEditCity(idx, newName);
+        appendToJournal("EDIT\t" + to_string(index) + "\t" + newName);
+        cout << "City updated successfully" << endl;
+    }
+
+    // Deletes a city together with its roads. The public indices of the
+    // other cities do not change, and the deleted index is not handed out
+    // again for the rest of the session.
+    void deleteCity(const string& name) {
+        auto timer = stats.time(Operation::DeleteCity);
+        int idx;
+        string error = checkDeleteCity(name, idx);
+        if (!error.empty()) {
+            cout << error << endl;
+            return;
+        }
+        
+        int index = cities[idx].getIndex();
+        loadNeighborRegions(idx);  // Its roads to other regions are deleted too
+        size_t roadCount = roads.neighbors(idx).size();
+        applyDeleteCity(idx);
+        appendToJournal("DELETECITY\t" + to_string(index));
+        cout << "City '" << name << "' deleted along with " << roadCount << " road(s)" << endl;
+    }
+
+    void deleteRoad(const string& city1, const string& city2) {
+        auto timer = stats.time(Operation::DeleteRoad);
+        int idx1, idx2;
+        string error = checkDeleteRoad(city1, city2, idx1, idx2);
+        if (!error.empty()) {
+            cout << error << endl;
+            return;
+        }
+        
+        applyDeleteRoad(idx1, idx2);
+        appendToJournal("DELETEROAD\t" + to_string(cities[idx1].getIndex()) + "\t" + to_string(cities[idx2].getIndex()));
+        cout << "Road between " << city1 << " and " << city2 << " deleted" << endl;
+    }
+
+    void setCityRegion(const string& city, const string& region) {
+        int idx;
+        string error = checkRegion(city, region, idx);
+        if (!error.empty()) {
+            cout << error << endl;
+            return;
+        }
+        
+        applySetRegion(idx, regionId(region));
+        appendToJournal("REGION\t" + to_string(cities[idx].getIndex()) + "\t" + region);
+        cout << city << " is now in region " << region << endl;
+    }
+
+    // Applies a file of commands (or standard input when path is "-") as one
+    // transaction. Each line is one tab-separated command:
+    //   city <name> / road <city1> <city2> / budget <city1> <city2> <amount> /
+    //   edit <index> <new name> / location <city> <latitude> <longitude> /
+    //   length <city1> <city2> <km> / region <city> <region name> /
+    //   delete-city <name> / delete-road <city1> <city2>
+    // Blank lines and lines starting with '#' are ignored. Nothing is saved
+    // unless every command succeeds; then the data files are written once.
+    bool runBatch(const string& path) {
+        auto start = chrono::steady_clock::now();
+        
+        string source = path == "-" ? "standard input" : path;
+        string input;
+        MappedFile mapped;
+        string_view text;
+        if (path == "-") {
+            input.assign(istreambuf_iterator<char>(cin), istreambuf_iterator<char>());
+            text = input;
+        } else {
+            if (!mapped.open(path.c_str())) {
+                cout << "Error opening " << path << " for reading!" << endl;
+                return false;
+            }
+            text = string_view(mapped.begin(), mapped.size());
+        }
+        
+        // Make room for all new cities up front
+        size_t newCities = 0;
+        LineCursor counter(text.data(), text.size());
+        string_view line;
+        while (counter.next(line)) {
+            if (line.substr(0, 5) == "city\t") {
+                newCities++;
+            }
+        }
+        ensureCityCapacity(cities.size() + newCities);
+        
+        LineCursor lines(text.data(), text.size());
+        size_t lineNumber = 0;
+        size_t applied = 0;
+        while (lines.next(line)) {
+            lineNumber++;
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            string error = applyBatchCommand(line);
+            if (!error.empty()) {
+                cout << source << " line " << lineNumber << ": " << error << endl;
+                cout << "Batch aborted; no changes were saved." << endl;
+                return false;
+            }
+            applied++;
+        }
+        
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (!saveAllData()) {
+            cout << "The batch could not be saved; run it again once the data files can be written." << endl;
+            return false;
+        }
+        rebuildHierarchy();
+        double totalSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        cout << applied << " commands applied in " << fixed << setprecision(3) << seconds << " seconds";
+        if (seconds > 0) {
+            cout << " (" << setprecision(0) << static_cast<double>(applied) / seconds << " commands/second)";
+        }
+        cout << endl;
+        cout << "Total including save: " << setprecision(3) << totalSeconds << " seconds" << endl;
+        return true;
+    }
+
+    void searchCity(int index) {
+        int idx = findCityIndexByIndex(index);
+        
+        printDivider('=', 60);
+        printTitle("SEARCH RESULTS", '=', 60);
+        printDivider('-', 60);
+        
+        if (idx == -1) {
+            cout << "No city found with index " << index << endl;
+            printDivider('-', 60);
+            return;
+        }
+        
+        cout << setw(10) << "INDEX" << setw(30) << "CITY NAME" << endl;
+        printDivider('-', 60);
+        cout << setw(10) << cities[idx].getIndex() << setw(30) << cities[idx].getName() << endl;
+        printDivider('=', 60);
+    }
+
+    // Number of roads at a city
+    size_t countRoads(int idx) {
+        if (ensureRoadBits()) {
+            return roadBits.degree(idx);
+        }
+        return roads.neighbors(idx).size();
+    }
+
+    // True if a road joins the two cities directly
+    bool areConnected(int idx1, int idx2) {
+        if (ensureRoadBits()) {
+            return roadBits.test(idx1, idx2);
+        }
+        return roads.hasRoad(idx1, idx2);
+    }
+
+    // Slots of the cities that have a road to both idx1 and idx2
+    void findCommonNeighbors(int idx1, int idx2, vector<int>& result) {
+        if (ensureRoadBits()) {
+            roadBits.commonNeighbors(idx1, idx2, result);
+            return;
+        }
+        // Merge the two sorted road lists
+        result.clear();
+        const vector<Road>& list1 = roads.neighbors(idx1);
+        const vector<Road>& list2 = roads.neighbors(idx2);
+        size_t i = 0, j = 0;
+        while (i < list1.size() && j < list2.size()) {
+            if (list1[i].neighbor < list2[j].neighbor) {
+                i++;
+            } else if (list2[j].neighbor < list1[i].neighbor) {
+                j++;
+            } else {
+                result.push_back(list1[i].neighbor);
+                i++;
+                j++;
+            }
+        }
+    }
+
+    // True if some sequence of roads leads from one city to the other
+    bool inSameNetwork(string_view city1, string_view city2) {
+        int idx1 = findCityIndexByName(city1);
+        int idx2 = findCityIndexByName(city2);
+        if (idx1 == -1 || idx2 == -1) {
+            return false;
+        }
+        loadReachableRegions();
+        ensureNetworks();
+        return networks.find(idx1) == networks.find(idx2);
+    }
+
+    // One entry per separate road network
+    struct NetworkSummary {
+        int representative;  // Slot of one city in the network
+        int cityCount;
+        int roadCount;
+        double totalBudget;
+    };
+
+    // All separate road networks, largest first
+    vector<NetworkSummary> getNetworks() {
+        prepareWholeNetwork();
+        ensureNetworks();
+        unordered_map<int, size_t> position;
+        vector<NetworkSummary> result;
+        for (size_t i = 0; i < cities.size(); i++) {
+            int root = networks.find(checkedCast<int>(i));
+            auto inserted = position.emplace(root, result.size());
+            if (inserted.second) {
+                result.push_back(NetworkSummary{(int)i, 0, 0, 0.0});
+            }
+            NetworkSummary& summary = result[inserted.first->second];
+            summary.cityCount++;
+            for (const Road& road : roads.neighbors(i)) {
+                if (road.neighbor > (int)i) {
+                    summary.roadCount++;
+                    summary.totalBudget += road.budget;
+                }
+            }
+        }
+        stable_sort(result.begin(), result.end(), [](const NetworkSummary& a, const NetworkSummary& b) {
+            return a.cityCount > b.cityCount;
+        });
+        return result;
+    }
+
+    void displayNetworks() {
+        vector<NetworkSummary> list = getNetworks();
+        
+        printDivider('=', 60);
+        printTitle("SEPARATE ROAD NETWORKS", '=', 60);
+        printDivider('-', 60);
+        
+        cout << setw(6) << "NBR" << setw(10) << "CITIES" << setw(10) << "ROADS"
+             << setw(16) << "BUDGET" << "  EXAMPLE CITY" << endl;
+        printDivider('-', 60);
+        
+        // Very fragmented data can have thousands of networks; show the largest
+        const size_t shown = min(list.size(), size_t(50));
+        for (size_t i = 0; i < shown; i++) {
+            cout << setw(6) << i + 1 << setw(10) << list[i].cityCount << setw(10) << list[i].roadCount
+                 << setw(16) << fixed << setprecision(2) << list[i].totalBudget
+                 << "  " << cities[list[i].representative].getName() << endl;
+        }
+        if (shown < list.size()) {
+            cout << "... and " << list.size() - shown << " smaller networks" << endl;
+        }
+        
+        printDivider('-', 60);
+        cout << "Networks: " << list.size() << endl;
+        printDivider('=', 60);
+    }
+
+    // The k most expensive roads, most expensive first
+    vector<RoadEdge> getTopBudgets(size_t k) {
+        loadAllRegions();
+        ensureBudgetIndex();
+        return budgetIndex.mostExpensive(k);
+    }
+
+    // Roads with a budget between low and high inclusive, cheapest first
+    vector<RoadEdge> getBudgetRange(double low, double high) {
+        loadAllRegions();
+        ensureBudgetIndex();
+        return budgetIndex.inRange(low, high);
+    }
+
+    // Total budget of the roads touching a city; false if there is no such city
+    bool getCityBudgetTotal(string_view city, double& total) {
+        int idx = findCityIndexByName(city);
+        if (idx == -1) {
+            return false;
+        }
+        loadNeighborRegions(idx);
+        ensureBudgetIndex();
+        total = budgetIndex.cityTotal(idx);
+        return true;
+    }
+
+    void displayBudgetedRoads(const vector<RoadEdge>& list, const string& title) {
+        printDivider('=', 60);
+        printTitle(title, '=', 60);
+        printDivider('-', 60);
+        
+        cout << setw(6) << "NBR" << "  " << left << setw(36) << "ROAD" << right << setw(16) << "BUDGET" << endl;
+        printDivider('-', 60);
+        for (size_t i = 0; i < list.size(); i++) {
+            cout << setw(6) << i + 1 << "  " << left << setw(36) << roadName(list[i].city1, list[i].city2) << right
+                 << setw(16) << fixed << setprecision(2) << list[i].budget << endl;
+        }
+        printDivider('-', 60);
+        cout << "Roads: " << list.size() << endl;
+        printDivider('=', 60);
+    }
+
+    void displayTopBudgets(size_t k) {
+        displayBudgetedRoads(getTopBudgets(k), "MOST EXPENSIVE ROADS");
+    }
+
+    void displayBudgetRange(double low, double high) {
+        if (low > high) {
+            cout << "The lowest budget must not be above the highest." << endl;
+            return;
+        }
+        displayBudgetedRoads(getBudgetRange(low, high), "ROADS WITH BUDGETS IN RANGE");
+    }
+
+    void displayCityBudgetTotal(const string& city) {
+        double total;
+        if (!getCityBudgetTotal(city, total)) {
+            cout << "City '" << city << "' does not exist!" << endl;
+            return;
+        }
+        cout << "Total budget of roads touching " << city << ": " << fixed << setprecision(2) << total
+             << " billion RWF" << endl;
+    }
+
+    void compareCities(const string& city1, const string& city2) {
+        int idx1 = findCityIndexByName(city1);
+        int idx2 = findCityIndexByName(city2);
+        
+        if (idx1 == -1) {
+            cout << "City '" << city1 << "' does not exist!" << endl;
+            return;
+        }
+        
+        if (idx2 == -1) {
+            cout << "City '" << city2 << "' does not exist!" << endl;
+            return;
+        }
+        
+        loadNeighborRegions(idx1);
+        loadNeighborRegions(idx2);
+        vector<int> common;
+        findCommonNeighbors(idx1, idx2, common);
+        
+        printDivider('=', 60);
+        printTitle("ROAD CONNECTIONS", '=', 60);
+        printDivider('-', 60);
+        cout << city1 << " has " << countRoads(idx1) << " road(s)" << endl;
+        cout << city2 << " has " << countRoads(idx2) << " road(s)" << endl;
+        cout << "Direct road between them: " << (areConnected(idx1, idx2) ? "yes" : "no") << endl;
+        cout << "Reachable from each other by road: " << (inSameNetwork(city1, city2) ? "yes" : "no") << endl;
+        cout << "Cities with a road to both: " << common.size() << endl;
+        for (int slot : common) {
+            cout << "  " << cities[slot].getName() << endl;
+        }
+        printDivider('=', 60);
+    }
+
+    // Cheapest route between two cities by total road budget. On success
+    // 'path' holds the public indices of the cities along the route.
+    bool getCheapestRoute(string_view from, string_view to, vector<int>& path, double& totalCost) {
+        auto timer = stats.time(Operation::CheapestRoute);
+        path.clear();
+        int source = findCityIndexByName(from);
+        int target = findCityIndexByName(to);
+        if (source == -1 || target == -1) {
+            return false;
+        }
+        loadReachableRegions();
+        if (!planRoute(RouteMetric::Budget, source, target, totalCost)) {
+            return false;
+        }
+        for (int slot : routeSlots) {
+            path.push_back(cities[slot].getIndex());
+        }
+        return true;
+    }
+
+    void findCheapestRoute(const string& city1, const string& city2) {
+        displayRoute(city1, city2, RouteMetric::Budget);
+    }
+
+    // Route with the fewest km of road, using recorded road lengths and,
+    // for roads without one, the distance between their cities
+    void findShortestRoute(const string& city1, const string& city2) {
+        displayRoute(city1, city2, RouteMetric::Length);
+    }
+
+    void displayRoute(const string& city1, const string& city2, RouteMetric metric) {
+        int idx1 = findCityIndexByName(city1);
+        int idx2 = findCityIndexByName(city2);
+        
+        if (idx1 == -1) {
+            cout << "City '" << city1 << "' does not exist!" << endl;
+            return;
+        }
+        
+        if (idx2 == -1) {
+            cout << "City '" << city2 << "' does not exist!" << endl;
+            return;
+        }
+        
+        loadReachableRegions();
+        double total;
+        bool found;
+        bool prepared = metric == RouteMetric::Budget && hierarchy;
+        {
+            auto timer = stats.time(Operation::CheapestRoute);
+            found = planRoute(metric, idx1, idx2, total);
+        }
+        if (!found) {
+            if (metric == RouteMetric::Length) {
+                cout << "No road route of known length exists between " << city1 << " and " << city2 << "!" << endl;
+            } else {
+                cout << "No road route exists between " << city1 << " and " << city2 << "!" << endl;
+            }
+            return;
+        }
+        
+        printDivider('=', 60);
+        printTitle(metric == RouteMetric::Budget ? "CHEAPEST ROUTE" : "SHORTEST ROUTE", '=', 60);
+        printDivider('-', 60);
+        
+        for (size_t i = 0; i < routeSlots.size(); i++) {
+            if (i > 0) {
+                cout << " -> ";
+            }
+            cout << cities[routeSlots[i]].getName();
+        }
+        cout << endl;
+        
+        printDivider('-', 60);
+        cout << "Roads used: " << routeSlots.size() - 1 << endl;
+        if (metric == RouteMetric::Budget) {
+            cout << "Total budget: " << fixed << setprecision(2) << total << " Billion RWF" << endl;
+            // Roads not yet budgeted are searched as if they cost nothing
+            size_t unbudgeted = 0;
+            for (size_t i = 1; i < routeSlots.size(); i++) {
+                if (roads.getBudget(routeSlots[i - 1], routeSlots[i]) == 0.0) {
+                    unbudgeted++;
+                }
+            }
+            if (unbudgeted > 0) {
+                cout << "Includes " << unbudgeted << " road(s) with no budget yet, counted as costing 0" << endl;
+            }
+        } else {
+            cout << "Total length: " << fixed << setprecision(2) << total << " km" << endl;
+        }
+        if (routeCache.lastLookupHit()) {
+            cout << "Answered from the route cache" << endl;
+        } else {
+            cout << "Cities searched: " << (prepared ? hierarchyQuery.getSettledCount() : routePlanner.getSettledCount())
+                 << " of " << cities.size() - deadCities << (prepared ? " (prepared network)" : "") << endl;
+        }
+        printDivider('=', 60);
+    }
+
+    // Computes the cheapest cost between every pair of cities, prints it when
+    // the table is small enough to read and exports it as CSV
+    void computeAllPairsCosts(const string& filename) {
+        prepareWholeNetwork();
+        if (cities.size() > AllPairsCosts::CITY_LIMIT) {
+            double gigabytes = double(cities.size()) * double(cities.size()) * sizeof(double) / 1e9;
+            cout << "The cost table for " << cities.size() << " cities would need "
+                 << fixed << setprecision(1) << gigabytes << " GB of memory." << endl;
+            cout << "It is only computed for up to " << AllPairsCosts::CITY_LIMIT
+                 << " cities; use the cheapest-route search (option 10) instead." << endl;
+            return;
+        }
+        auto start = chrono::steady_clock::now();
+        AllPairsCosts table;
+        table.compute(roads);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        printDivider('=', 60);
+        printTitle("ALL-PAIRS CHEAPEST COSTS (Billion RWF)", '=', 60);
+        printDivider('-', 60);
+        cout << "Cities: " << cities.size() << ", roads: " << roads.getRoadCount() << endl;
+        cout << "Method: " << (table.computedWithFloydWarshall() ? "tiled Floyd-Warshall" : "Dijkstra from every city")
+             << " on " << max(1u, thread::hardware_concurrency()) << " thread(s)" << endl;
+        cout << "Computed in " << fixed << setprecision(3) << seconds << " seconds" << endl;
+        printDivider('-', 60);
+        
+        // Only small tables are readable on the console
+        if (cities.size() <= 20) {
+            cout << setw(6) << " ";
+            for (size_t j = 0; j < cities.size(); j++) {
+                cout << setw(7) << cities[j].getIndex();
+            }
+            cout << endl;
+            printDivider('-', 60);
+            for (size_t i = 0; i < cities.size(); i++) {
+                cout << setw(4) << cities[i].getIndex() << " |";
+                for (size_t j = 0; j < cities.size(); j++) {
+                    double cost = table.cost(i, j);
+                    if (cost == numeric_limits<double>::infinity()) {
+                        cout << setw(7) << "-";
+                    } else {
+                        cout << fixed << setprecision(1) << setw(7) << cost;
+                    }
+                }
+                cout << endl;
+            }
+            printDivider('-', 60);
+        }
+        
+        ofstream file(filename);
+        if (!file.is_open()) {
+            cout << "Error opening " << filename << " for writing!" << endl;
+            return;
+        }
+        
+        // Header row of city names, then one row per city; unreachable
+        // pairs are left empty
+        file << "City";
+        for (const auto& city : cities) {
+            file << "," << city.getName();
+        }
+        file << "\n";
+        for (size_t i = 0; i < cities.size(); i++) {
+            file << cities[i].getName();
+            for (size_t j = 0; j < cities.size(); j++) {
+                file << ",";
+                double cost = table.cost(i, j);
+                if (cost != numeric_limits<double>::infinity()) {
+                    file << fixed << setprecision(2) << cost;
+                }
+            }
+            file << "\n";
+        }
+        
+        file.close();
+        cout << "Cost table saved to " << filename << endl;
+        printDivider('=', 60);
+    }
+
+    // Lists the cheapest set of roads that still connects every city
+    void displayMinimumSpanningNetwork() {
+        prepareWholeNetwork();
+        SpanningNetwork network;
+        network.compute(roads);
+        
+        vector<RoadEdge> selected = network.getSelectedRoads();
+        sort(selected.begin(), selected.end(), [](const RoadEdge& a, const RoadEdge& b) {
+            return a.budget < b.budget;
+        });
+        
+        printDivider('=', 60);
+        printTitle("MINIMUM-BUDGET ROAD NETWORK", '=', 60);
+        printDivider('-', 60);
+        
+        cout << setw(6) << "NBR" << setw(36) << "ROAD" << setw(16) << "BUDGET" << endl;
+        printDivider('-', 60);
+        
+        int roadNumber = 0;
+        for (const RoadEdge& edge : selected) {
+            roadNumber++;
+            cout << setw(6) << roadNumber
+                 << setw(36) << roadName(edge.city1, edge.city2)
+                 << setw(16) << fixed << setprecision(2) << edge.budget << endl;
+        }
+        
+        printDivider('-', 60);
+        cout << "Roads kept: " << selected.size() << " of " << roads.getRoadCount() << endl;
+        cout << "Total budget: " << fixed << setprecision(2) << network.getTotalBudget() << " Billion RWF" << endl;
+        if (network.getComponentCount() > 1) {
+            cout << "The cities form " << network.getComponentCount()
+                 << " separate networks; no set of recorded roads connects them all." << endl;
+        }
+        printDivider('=', 60);
+    }
+
+    // Roads and cities whose closure would cut cities off from the rest of
+    // their network, the 'count' with the largest budgets of each
+    void displayCriticalInfrastructure(size_t count) {
+        prepareWholeNetwork();
+        auto start = chrono::steady_clock::now();
+        CriticalInfrastructure analysis;
+        analysis.compute(roads);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        const auto& criticalRoads = analysis.getRoads();
+        const auto& criticalCities = analysis.getCities();
+        
+        printDivider('=', 60);
+        printTitle("CRITICAL ROADS AND CITIES", '=', 60);
+        printDivider('-', 60);
+        cout << "Cities: " << cities.size() << ", roads: " << roads.getRoadCount() << endl;
+        cout << "Found in " << fixed << setprecision(3) << seconds << " seconds" << endl;
+        printDivider('-', 60);
+        
+        cout << "Roads whose closure splits a network (by budget):" << endl;
+        cout << setw(6) << "NBR" << "  " << left << setw(30) << "ROAD" << right << setw(12) << "BUDGET"
+             << setw(10) << "CUT OFF" << endl;
+        for (size_t i = 0; i < criticalRoads.size() && i < count; i++) {
+            const auto& road = criticalRoads[i];
+            cout << setw(6) << i + 1 << "  " << left << setw(30) << roadName(road.city1, road.city2) << right
+                 << setw(12) << setprecision(2) << road.budget << setw(10) << road.citiesCutOff << endl;
+        }
+        printDivider('-', 60);
+        
+        cout << "Cities whose closure splits a network (by budget of their roads):" << endl;
+        cout << setw(6) << "NBR" << "  " << left << setw(30) << "CITY" << right << setw(12) << "BUDGET"
+             << setw(10) << "CUT OFF" << endl;
+        for (size_t i = 0; i < criticalCities.size() && i < count; i++) {
+            const auto& city = criticalCities[i];
+            cout << setw(6) << i + 1 << "  " << left << setw(30) << cities[city.city].getName() << right
+                 << setw(12) << setprecision(2) << city.budget << setw(10) << city.citiesCutOff << endl;
+        }
+        printDivider('-', 60);
+        cout << "Critical roads: " << criticalRoads.size() << ", critical cities: " << criticalCities.size() << endl;
+        cout << "CUT OFF is the number of cities separated from the larger part of their network." << endl;
+        printDivider('=', 60);
+    }
+
+    void displayCities() {
+        prepareWholeNetwork();
+        auto timer = stats.time(Operation::RenderReport);
+        TextBuffer out;
+        renderCities(out);
+        out.writeTo(cout);
+    }
+
+    void displayRoads() {
+        prepareWholeNetwork();
+        auto timer = stats.time(Operation::RenderReport);
+        TextBuffer out;
+        renderCities(out);
+        renderRoadMatrix(out);
+        out.writeTo(cout);
+    }
+
+    void displayAllData() {
+        prepareWholeNetwork();
+        auto timer = stats.time(Operation::RenderReport);
+        TextBuffer out;
+        renderCities(out);
+        renderRoadMatrix(out);
+        renderBudgetMatrix(out);
+        out.writeTo(cout);
+    }
+
+    // Shows the road list, or everything including both matrices, page by
+    // page, through the system pager, or written to a file. Matrices for a
+    // few thousand cities are far too wide for the screen, so they are
+    // only offered for files.
+    void showReport(ReportView view, bool withMatrices, const string& filename) {
+        prepareWholeNetwork();
+        TextBuffer out;
+        {
+            // Only the rendering is timed, not the time spent reading pages
+            auto timer = stats.time(Operation::RenderReport);
+            out.reserve(withMatrices ? cities.size() * cities.size() * 11 + 4096 : roads.getRoadCount() * 64 + 4096);
+            renderCities(out);
+            if (withMatrices) {
+                renderRoadMatrix(out);
+                renderBudgetMatrix(out);
+            }
+            renderRoadList(out);
+        }
+        
+        switch (view) {
+            case ReportView::Paged:
+                pageThrough(out.str(), 20);
+                break;
+            case ReportView::Pager:
+                if (!sendToPager(out.str())) {
+                    cout << "Could not start a pager; showing the report page by page." << endl;
+                    pageThrough(out.str(), 20);
+                }
+                break;
+            case ReportView::File:
+                if (out.writeToFile(filename)) {
+                    cout << "Report saved to " << filename << " (" << out.size() << " bytes)" << endl;
+                } else {
+                    cout << "Error opening " << filename << " for writing!" << endl;
+                }
+                break;
+        }
+    }
+
+    // The text files are written to a temporary file and renamed over the
+    // old one, so a failed save leaves the previous data in place
+    bool saveCitiesToFile() {
+        ofstream file("cities.txt.tmp");
+        
+        if (!file.is_open()) {
+            cout << "Error opening cities.txt.tmp for writing!" << endl;
+            return false;
+        }
+        
+        // Locations are written as two extra columns and regions as a last
+        // one; files without any stay in the original two-column layout
+        bool anyLocated = any_of(cities.begin(), cities.end(), [](const City& city) { return city.hasLocation(); });
+        bool anyRegion = regionNames.size() > 1;
+        // Indices of deleted cities above every remaining one are not
+        // handed out again, so the highest one goes on a line of its own
+        int highestListed = 0;
+        for (const auto& city : cities) {
+            highestListed = max(highestListed, city.getIndex());
+        }
+        if (highestIndex > highestListed) {
+            file << "Highest_index\t" << highestIndex << endl;
+        }
+        file << (anyLocated ? "Index\tCity_name\tLatitude\tLongitude" : "Index\tCity_name")
+             << (anyRegion ? "\tRegion" : "") << endl;
+        file << fixed << setprecision(6);
+        for (const auto& city : cities) {
+            file << city.getIndex() << "\t" << city.getName();
+            if (city.hasLocation()) {
+                file << "\t" << city.getLatitude() << "\t" << city.getLongitude();
+            }
+            if (anyRegion) {
+                file << "\t" << regionNames[city.getRegion()];
+            }
+            file << endl;
+        }
+        
+        file.close();
+        if (!file || rename("cities.txt.tmp", "cities.txt") != 0) {
+            cout << "Error writing cities.txt!" << endl;
+            return false;
+        }
+        cout << "Cities saved to cities.txt" << endl;
+        return true;
+    }
+
+    bool saveRoadsToFile() {
+        ofstream file("roads.txt.tmp");
+        
+        if (!file.is_open()) {
+            cout << "Error opening roads.txt.tmp for writing!" << endl;
+            return false;
+        }
+        
+        // Recorded lengths go in an extra column, only on roads that have one
+        bool anyLength = false;
+        for (size_t i = 0; i < cities.size() && !anyLength; i++) {
+            for (const Road& road : roads.neighbors(i)) {
+                anyLength = anyLength || road.length > 0.0f;
+            }
+        }
+        file << (anyLength ? "Nbr\tRoad\t\t\tBudget\tLength" : "Nbr\tRoad\t\t\tBudget") << endl;
+        
+        // Each road is written once, from its lower-numbered endpoint
+        int roadCount = 0;
+        for (size_t i = 0; i < cities.size(); i++) {
+            for (const Road& road : roads.neighbors(i)) {
+                if (road.neighbor > (int)i) {
+                    roadCount++;
+                    file << roadCount << ".\t" 
+                         << cities[i].getName() << "-" << cities[road.neighbor].getName() 
+                         << "\t\t" << formatBudget(road.budget);
+                    if (road.length > 0.0f) {
+                        file << "\t" << formatExact(road.length);
+                    }
+                    file << endl;
+                }
+            }
+        }
+        
+        file.close();
+        if (!file || rename("roads.txt.tmp", "roads.txt") != 0) {
+            cout << "Error writing roads.txt!" << endl;
+            return false;
+        }
+        cout << "Roads saved to roads.txt" << endl;
+        return true;
+    }
+    
+    void loadCitiesFromFile() {
+        auto timer = stats.time(Operation::LoadCities);
+        MappedFile file;
+        
+        if (!file.open("cities.txt")) {
+            cout << "No previous cities data found." << endl;
+            return;
+        }
+        
+        LineCursor lines(file.begin(), file.size());
+        string_view line;
+        size_t lineNumber = 1;
+        int savedHighest = 0;
+        lines.next(line);
+        if (line.substr(0, 14) == "Highest_index\t") {
+            line.remove_prefix(14);
+            if (!consumeInt(line, savedHighest) || !line.empty()) {
+                cout << "cities.txt line 1: invalid highest index" << endl;
+            }
+            lines.next(line);
+            lineNumber++;
+        }
+        // The header says whether the last column is the region
+        bool withRegions = line.size() >= 7 && line.substr(line.size() - 7) == "\tRegion";
+        
+        cities.clear(); // Clear existing cities
+        deadCities = 0;
+        resetRegions();
+        roads.clear();
+        roadsReplaced();
+        // Names take up less than the file, so this is enough room for all
+        names->reserve(file.size());
+        
+        while (lines.next(line)) {
+            lineNumber++;
+            if (line.empty()) {
+                continue;
+            }
+            
+            // Index, one tab, then the rest of the line is the name
+            int index;
+            if (!consumeInt(line, index) || line.empty() || line[0] != '\t') {
+                cout << "cities.txt line " << lineNumber << ": expected an index followed by a tab" << endl;
+                continue;
+            }
+            line.remove_prefix(1);
+            
+            int region = 0;
+            if (withRegions) {
+                size_t regionTab = line.rfind('\t');
+                if (regionTab == string_view::npos) {
+                    cout << "cities.txt line " << lineNumber << ": missing region" << endl;
+                    continue;
+                }
+                region = regionId(line.substr(regionTab + 1));
+                if (region == -1) {
+                    cout << "cities.txt line " << lineNumber << ": too many regions" << endl;
+                    continue;
+                }
+                line = line.substr(0, regionTab);
+            }
+            
+            // ... unless it ends in "<tab><latitude><tab><longitude>"
+            double latitude = numeric_limits<double>::quiet_NaN();
+            double longitude = numeric_limits<double>::quiet_NaN();
+            size_t lonTab = line.rfind('\t');
+            size_t latTab = lonTab == string_view::npos || lonTab == 0 ? string_view::npos : line.rfind('\t', lonTab - 1);
+            if (latTab != string_view::npos) {
+                string_view lat = line.substr(latTab + 1, lonTab - latTab - 1);
+                string_view lon = line.substr(lonTab + 1);
+                double a, b;
+                if (consumeDouble(lat, a) && lat.empty() && consumeDouble(lon, b) && lon.empty()) {
+                    if (a < -90.0 || a > 90.0 || b < -180.0 || b > 180.0) {
+                        cout << "cities.txt line " << lineNumber << ": location out of range" << endl;
+                        continue;
+                    }
+                    latitude = a;
+                    longitude = b;
+                    line = line.substr(0, latTab);
+                }
+            }
+            if (line.empty()) {
+                cout << "cities.txt line " << lineNumber << ": missing city name" << endl;
+                continue;
+            }
+            
+            cities.push_back(City(index, names->store(line), latitude, longitude));
+            cities.back().setRegion(region);
+        }
+        
+        rebuildCityIndex();
+        highestIndex = max(highestIndex, savedHighest);
+        
+        // One road list per loaded city
+        if (!cities.empty()) {
+            roads.resize(cities.size());
+            cout << cities.size() << " cities loaded from cities.txt" << endl;
+        }
+    }
+    
+    // Splits "City1-City2" into two known cities. City names may contain
+    // hyphens themselves, so every hyphen is tried until both sides match.
+    bool resolveRoadName(string_view roadName, int& idx1, int& idx2) const {
+        for (size_t hyphen = roadName.find('-'); hyphen != string_view::npos; hyphen = roadName.find('-', hyphen + 1)) {
+            idx1 = findSlotByName(roadName.substr(0, hyphen));
+            if (idx1 == -1) {
+                continue;
+            }
+            idx2 = findSlotByName(roadName.substr(hyphen + 1));
+            if (idx2 != -1) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Parses one line of roads.txt:
+    //   "<number>.<tab><city1>-<city2><tabs><budget>[<tab><length>]"
+    // Returns an error message, or an empty string with 'keep' telling
+    // whether 'edge' holds a road (blank lines and roads from a city to
+    // itself are skipped). Only reads shared state, so loader threads can
+    // call it at the same time.
+    string parseRoadLine(string_view line, RoadEdge& edge, bool& keep) const {
+        keep = false;
+        if (line.empty()) {
+            return "";
+        }
+        
+        int roadNum;
+        if (!consumeInt(line, roadNum) || line.empty() || line[0] != '.') {
+            return "expected a road number";
+        }
+        line.remove_prefix(1);
+        skipTabs(line);
+        
+        size_t tab = line.find('\t');
+        if (tab == string_view::npos) {
+            return "missing budget";
+        }
+        string_view roadName = line.substr(0, tab);
+        line.remove_prefix(tab);
+        skipTabs(line);
+        
+        double budget;
+        if (!consumeDouble(line, budget) || (!line.empty() && line[0] != '\t')) {
+            return "invalid budget";
+        }
+        double length = 0.0;
+        if (!line.empty()) {
+            skipTabs(line);
+            if (!consumeDouble(line, length) || !line.empty() || !(length >= 0.0 && length < 1e6)) {
+                return "invalid length";
+            }
+        }
+        
+        int idx1, idx2;
+        if (!resolveRoadName(roadName, idx1, idx2)) {
+            return "unknown cities in road '" + string(roadName) + "'";
+        }
+        
+        edge = RoadEdge{idx1, idx2, budget, (float)length};
+        keep = idx1 != idx2;
+        return "";
+    }
+
+    // A run of whole lines of roads.txt, parsed by one loader thread
+    struct RoadChunk {
+        const char* begin;
+        const char* end;
+        size_t lineCount = 0;
+        vector<RoadEdge> edges;
+        vector<pair<size_t, string>> errors;  // Line within the chunk, message
+    };
+
+    void parseRoadChunk(RoadChunk& chunk) const {
+        LineCursor lines(chunk.begin, chunk.end - chunk.begin);
+        string_view line;
+        chunk.edges.reserve((chunk.end - chunk.begin) / 32);
+        while (lines.next(line)) {
+            chunk.lineCount++;
+            RoadEdge edge;
+            bool keep;
+            string error = parseRoadLine(line, edge, keep);
+            if (!error.empty()) {
+                chunk.errors.push_back({chunk.lineCount, move(error)});
+            } else if (keep) {
+                chunk.edges.push_back(edge);
+            }
+        }
+    }
+
+    // Files larger than this are split at line boundaries and parsed on
+    // several threads; each chunk is parsed into its own edge list, so the
+    // threads share nothing but the read-only name index. Chunks are then
+    // joined in file order, which gives exactly the serial result.
+    static const size_t PARALLEL_LOAD_MIN_BYTES = 4 << 20;
+    
+    void loadRoadsFromFile() {
+        auto timer = stats.time(Operation::LoadRoads);
+        MappedFile file;
+        
+        if (!file.open("roads.txt")) {
+            cout << "No previous roads data found." << endl;
+            return;
+        }
+        
+        // Skip header line
+        const char* begin = file.begin();
+        const char* end = begin + file.size();
+        const char* headerEnd = (const char*)memchr(begin, '\n', file.size());
+        begin = headerEnd ? headerEnd + 1 : end;
+        
+        size_t chunkCount = 1;
+        if ((size_t)(end - begin) >= PARALLEL_LOAD_MIN_BYTES) {
+            chunkCount = min<size_t>(4 * max(1u, thread::hardware_concurrency()),
+                                     (end - begin) / (PARALLEL_LOAD_MIN_BYTES / 4));
+        }
+        vector<RoadChunk> chunks(chunkCount);
+        for (size_t i = 0; i < chunkCount; i++) {
+            chunks[i].begin = i == 0 ? begin : chunks[i - 1].end;
+            chunks[i].end = end;
+            if (i + 1 < chunkCount) {
+                const char* target = max(chunks[i].begin, begin + (end - begin) / chunkCount * (i + 1));
+                const char* newline = (const char*)memchr(target, '\n', end - target);
+                chunks[i].end = newline ? newline + 1 : end;
+            }
+        }
+        
+        parallelFor(chunkCount, [&](size_t i) { parseRoadChunk(chunks[i]); });
+        
+        // Report problems in file order; line 1 is the header
+        size_t firstLine = 2;
+        size_t edgeCount = 0;
+        vector<size_t> edgeOffset(chunkCount);
+        for (RoadChunk& chunk : chunks) {
+            for (const auto& [line, error] : chunk.errors) {
+                cout << "roads.txt line " << firstLine + line - 1 << ": " << error << endl;
+            }
+            firstLine += chunk.lineCount;
+            edgeOffset[&chunk - chunks.data()] = edgeCount;
+            edgeCount += chunk.edges.size();
+        }
+        
+        // Roads are collected first and added to the graph in one go
+        vector<RoadEdge> loaded;
+        if (chunkCount == 1) {
+            loaded = move(chunks[0].edges);
+        } else {
+            loaded.resize(edgeCount);
+            parallelFor(chunkCount, [&](size_t i) {
+                copy(chunks[i].edges.begin(), chunks[i].edges.end(), loaded.begin() + edgeOffset[i]);
+                vector<RoadEdge>().swap(chunks[i].edges);
+            });
+        }
+        
+        roads.addRoads(loaded);
+        roadsReplaced();
+        cout << "Roads and budgets loaded from roads.txt" << endl;
+    }
+    
+    // Writes infrastructure.snap. The file is built under a temporary name
+    // and renamed into place, so a crash never leaves a half-written snapshot.
+    bool saveSnapshot() {
+        SnapshotHeader header;
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.headerSize = sizeof(SnapshotHeader);
+        header.cityCount = cities.size();
+        header.regionCount = regionNames.size();
+        header.nameBytes = 0;
+        header.roadEntries = 2 * roads.getRoadCount();
+        header.highestIndex = highestIndex;
+        
+        vector<SnapshotCity> table(cities.size());
+        vector<uint64_t> offsets(cities.size() + 1, 0);
+        for (size_t i = 0; i < cities.size(); i++) {
+            table[i].index = cities[i].getIndex();
+            table[i].nameLength = checkedCast<uint32_t>(cities[i].getName().size());
+            table[i].nameOffset = header.nameBytes;
+            table[i].latitude = cities[i].getLatitude();
+            table[i].longitude = cities[i].getLongitude();
+            table[i].region = cities[i].getRegion();
+            table[i].unused = 0;
+            header.nameBytes += cities[i].getName().size();
+            offsets[i + 1] = offsets[i] + roads.neighbors(i).size();
+        }
+        vector<SnapshotRegion> regionTable(regionNames.size());
+        for (size_t r = 0; r < regionNames.size(); r++) {
+            regionTable[r].nameOffset = header.nameBytes;
+            regionTable[r].nameLength = regionNames[r].size();
+            header.nameBytes += regionNames[r].size();
+        }
+        
+        const char* tempName = "infrastructure.snap.tmp";
+        ofstream file(tempName, ios::binary | ios::trunc);
+        if (!file.is_open()) {
+            cout << "Error opening " << tempName << " for writing!" << endl;
+            return false;
+        }
+        
+        const char padding[8] = {0};
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)table.data(), table.size() * sizeof(SnapshotCity));
+        file.write((const char*)regionTable.data(), regionTable.size() * sizeof(SnapshotRegion));
+        for (const auto& city : cities) {
+            file.write(city.getName().data(), city.getName().size());
+        }
+        for (const string& region : regionNames) {
+            file.write(region.data(), region.size());
+        }
+        file.write(padding, alignTo8(header.nameBytes) - header.nameBytes);
+        file.write((const char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+        for (size_t i = 0; i < cities.size(); i++) {
+            const vector<Road>& list = roads.neighbors(i);
+            file.write((const char*)list.data(), list.size() * sizeof(Road));
+        }
+        
+        file.close();
+        if (!file || rename(tempName, "infrastructure.snap") != 0) {
+            cout << "Error writing infrastructure.snap!" << endl;
+            return false;
+        }
+        cout << "Snapshot saved to infrastructure.snap" << endl;
+        return true;
+    }
+
+    // Loads infrastructure.snap through a memory mapping. Returns false,
+    // leaving the current data untouched, if the file is missing or invalid.
+    bool loadSnapshot() {
+        auto timer = stats.time(Operation::LoadSnapshot);
+        MappedFile file;
+        if (!file.open("infrastructure.snap")) {
+            return false;
+        }
+        
+        const char* base = file.begin();
+        SnapshotHeader header;
+        if (file.size() < sizeof(header)) {
+            return false;
+        }
+        memcpy(&header, base, sizeof(header));
+        if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != SNAPSHOT_VERSION || header.headerSize != sizeof(SnapshotHeader)) {
+            cout << "infrastructure.snap has an unknown format; ignoring it." << endl;
+            return false;
+        }
+        
+        // Check every section fits before touching any of them
+        uint64_t tableStart = sizeof(SnapshotHeader);
+        uint64_t regionsStart = tableStart + header.cityCount * sizeof(SnapshotCity);
+        uint64_t namesStart = regionsStart + header.regionCount * sizeof(SnapshotRegion);
+        uint64_t offsetsStart = namesStart + alignTo8(header.nameBytes);
+        uint64_t roadsStart = offsetsStart + (header.cityCount + 1) * sizeof(uint64_t);
+        uint64_t end = roadsStart + header.roadEntries * sizeof(Road);
+        if (header.cityCount > file.size() || header.regionCount == 0 || header.regionCount > MAX_REGIONS ||
+            header.nameBytes > file.size() || header.roadEntries > file.size() || end != file.size() ||
+            header.highestIndex < 0 || header.highestIndex > numeric_limits<int>::max()) {
+            cout << "infrastructure.snap is damaged; ignoring it." << endl;
+            return false;
+        }
+        
+        const SnapshotCity* table = (const SnapshotCity*)(base + tableStart);
+        const SnapshotRegion* regionTable = (const SnapshotRegion*)(base + regionsStart);
+        const char* nameBytes = base + namesStart;
+        const uint64_t* offsets = (const uint64_t*)(base + offsetsStart);
+        const Road* edges = (const Road*)(base + roadsStart);
+        
+        if (offsets[0] != 0 || offsets[header.cityCount] != header.roadEntries) {
+            cout << "infrastructure.snap is damaged; ignoring it." << endl;
+            return false;
+        }
+        for (uint64_t i = 0; i < header.cityCount; i++) {
+            if (offsets[i] > offsets[i + 1] || table[i].nameOffset + table[i].nameLength > header.nameBytes ||
+                table[i].region >= header.regionCount) {
+                cout << "infrastructure.snap is damaged; ignoring it." << endl;
+                return false;
+            }
+        }
+        for (uint64_t r = 0; r < header.regionCount; r++) {
+            if (regionTable[r].nameOffset + regionTable[r].nameLength > header.nameBytes) {
+                cout << "infrastructure.snap is damaged; ignoring it." << endl;
+                return false;
+            }
+        }
+        for (uint64_t e = 0; e < header.roadEntries; e++) {
+            if (edges[e].neighbor < 0 || (uint64_t)edges[e].neighbor >= header.cityCount) {
+                cout << "infrastructure.snap is damaged; ignoring it." << endl;
+                return false;
+            }
+        }
+        
+        cities.clear();
+        deadCities = 0;
+        resetRegions();
+        for (uint64_t r = 1; r < header.regionCount; r++) {
+            regionId(string_view(nameBytes + regionTable[r].nameOffset, regionTable[r].nameLength));
+        }
+        cities.reserve(header.cityCount);
+        names->reserve(header.nameBytes);
+        for (uint64_t i = 0; i < header.cityCount; i++) {
+            string_view name(nameBytes + table[i].nameOffset, table[i].nameLength);
+            cities.push_back(City(table[i].index, names->store(name), table[i].latitude, table[i].longitude));
+            cities.back().setRegion(table[i].region);
+        }
+        rebuildCityIndex();
+        highestIndex = max(highestIndex, (int)header.highestIndex);
+        roads.assign(header.cityCount, offsets, edges);
+        roadsReplaced();
+        
+        cout << cities.size() << " cities and " << roads.getRoadCount()
+             << " roads loaded from infrastructure.snap" << endl;
+        return true;
+    }
+
+    // True when the snapshot exists and is at least as recent as the text
+    // files, i.e. nobody has edited cities.txt or roads.txt since it was saved
+    static bool snapshotIsCurrent() {
+        struct stat snapshot;
+        if (stat("infrastructure.snap", &snapshot) != 0) {
+            return false;
+        }
+        for (const char* textFile : {"cities.txt", "roads.txt"}) {
+            struct stat text;
+            if (stat(textFile, &text) == 0) {
+                if (text.st_mtim.tv_sec > snapshot.st_mtim.tv_sec ||
+                    (text.st_mtim.tv_sec == snapshot.st_mtim.tv_sec && text.st_mtim.tv_nsec > snapshot.st_mtim.tv_nsec)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    static string regionFile(int region) {
+        return "regions/" + to_string(region) + ".txt";
+    }
+
+    string regionLabel(int region) const {
+        return region == 0 ? "(none)" : regionNames[region];
+    }
+
+    static bool consumeTab(string_view& text) {
+        if (text.empty() || text[0] != '\t') {
+            return false;
+        }
+        text.remove_prefix(1);
+        return true;
+    }
+
+    // "<index1><tab><index2><tab><budget><tab><length>", as in region files
+    static bool parseStoredRoad(string_view line, PendingRoad& road) {
+        double length;
+        if (!consumeInt(line, road.index1) || !consumeTab(line) || !consumeInt(line, road.index2) ||
+            !consumeTab(line) || !consumeDouble(line, road.budget) || !consumeTab(line) ||
+            !consumeDouble(line, length) || !line.empty()) {
+            return false;
+        }
+        road.length = static_cast<float>(length);
+        return true;
+    }
+
+    static void appendStoredRoad(TextBuffer& out, int index1, int index2, double budget, float length) {
+        out.append("ROAD\t").append(index1).append("\t").append(index2).append("\t").append(formatExact(budget))
+           .append("\t").append(formatExact(length)).newline();
+    }
+
+    static bool replaceFile(const string& path, const TextBuffer& contents) {
+        string tempName = path + ".tmp";
+        return contents.writeToFile(tempName) && rename(tempName.c_str(), path.c_str()) == 0;
+    }
+
+    // Reads the directory of cities and the roads between regions. Returns
+    // false, changing nothing, when the data is not stored by region.
+    //   regions/index.txt: HIGHEST <index> / REGION <id> <name> /
+    //                      CITY <index> <region id> <name>
+    //   regions/cross.txt: ROAD <index1> <index2> <budget> <length>
+    bool loadRegionIndex() {
+        MappedFile index;
+        if (!index.open("regions/index.txt")) {
+            return false;
+        }
+        auto timer = stats.time(Operation::LoadRegion);
+        sharded = true;
+        cities.clear();
+        deadCities = 0;
+        roads.clear();
+        roadsReplaced();
+        
+        LineCursor lines(index.begin(), index.size());
+        string_view line;
+        size_t lineNumber = 0;
+        while (lines.next(line)) {
+            lineNumber++;
+            if (line.empty()) {
+                continue;
+            }
+            if (line.substr(0, 8) == "HIGHEST\t") {
+                line.remove_prefix(8);
+                int saved;
+                if (consumeInt(line, saved) && line.empty()) {
+                    highestIndex = max(highestIndex, saved);
+                } else {
+                    cout << "regions/index.txt line " << lineNumber << ": unreadable entry" << endl;
+                }
+                continue;
+            }
+            bool isRegion = line.substr(0, 7) == "REGION\t";
+            bool isCity = line.substr(0, 5) == "CITY\t";
+            line.remove_prefix(isRegion ? 7 : isCity ? 5 : 0);
+            int number, region = 0;
+            if ((!isRegion && !isCity) || !consumeInt(line, number) || !consumeTab(line) ||
+                (isCity && (!consumeInt(line, region) || !consumeTab(line) || line.empty()))) {
+                cout << "regions/index.txt line " << lineNumber << ": unreadable entry" << endl;
+                continue;
+            }
+            if (isRegion) {
+                // Listed in id order, so the ids come out the same
+                if (number != 0 && regionId(line) != number) {
+                    cout << "regions/index.txt line " << lineNumber << ": region out of order" << endl;
+                }
+                continue;
+            }
+            if (region < 0 || region >= (int)regionNames.size() || storedByIndex.count(number) > 0 ||
+                storedByName.count(line) > 0) {
+                cout << "regions/index.txt line " << lineNumber << ": unknown region or duplicate city" << endl;
+                continue;
+            }
+            string_view name = names->store(line);
+            storedByIndex.emplace(number, StoredCity{name, region});
+            storedByName.emplace(name, number);
+            highestIndex = max(highestIndex, number);
+        }
+        regionLoaded.assign(regionNames.size(), false);
+        
+        MappedFile cross;
+        if (cross.open("regions/cross.txt")) {
+            LineCursor roadLines(cross.begin(), cross.size());
+            lineNumber = 0;
+            while (roadLines.next(line)) {
+                lineNumber++;
+                PendingRoad road;
+                if (line.empty()) {
+                    continue;
+                }
+                if (line.substr(0, 5) != "ROAD\t" || !parseStoredRoad(line.substr(5), road) ||
+                    storedByIndex.count(road.index1) == 0 || storedByIndex.count(road.index2) == 0) {
+                    cout << "regions/cross.txt line " << lineNumber << ": unreadable road or unknown city" << endl;
+                    continue;
+                }
+                pendingRoads.push_back(road);
+            }
+        }
+        
+        cout << storedByIndex.size() << " cities in " << regionNames.size() - 1
+             << " regions listed in regions/index.txt; each region is loaded when first used" << endl;
+        return true;
+    }
+
+    // Loads one region's cities and roads, and the roads between it and
+    // regions that are loaded already
+    void loadRegion(int region) {
+        if (regionLoaded[region]) {
+            return;
+        }
+        auto timer = stats.time(Operation::LoadRegion);
+        regionLoaded[region] = true;
+        string path = regionFile(region);
+        MappedFile file;
+        if (!file.open(path.c_str())) {
+            cout << "Error opening " << path << " for reading!" << endl;
+            return;
+        }
+        
+        //   CITY <index> <latitude> <longitude> / ROAD <index1> <index2> <budget> <length>
+        size_t firstSlot = cities.size();
+        vector<PendingRoad> inside;
+        LineCursor lines(file.begin(), file.size());
+        string_view line;
+        size_t lineNumber = 0;
+        while (lines.next(line)) {
+            lineNumber++;
+            if (line.empty()) {
+                continue;
+            }
+            if (line.substr(0, 5) == "ROAD\t") {
+                PendingRoad road;
+                if (parseStoredRoad(line.substr(5), road)) {
+                    inside.push_back(road);
+                    continue;
+                }
+            } else if (line.substr(0, 5) == "CITY\t") {
+                line.remove_prefix(5);
+                int index;
+                double latitude, longitude;
+                auto stored = consumeInt(line, index) ? storedByIndex.find(index) : storedByIndex.end();
+                if (stored != storedByIndex.end() && stored->second.region == region && consumeTab(line) &&
+                    consumeDouble(line, latitude) && consumeTab(line) && consumeDouble(line, longitude) && line.empty()) {
+                    cities.push_back(City(index, stored->second.name, latitude, longitude));
+                    cities.back().setRegion(region);
+                    storedByName.erase(stored->second.name);
+                    storedByIndex.erase(stored);
+                    indexCity(checkedCast<int>(cities.size() - 1));
+                    continue;
+                }
+            }
+            cout << path << " line " << lineNumber << ": unreadable entry or unknown city" << endl;
+        }
+        roads.resize(cities.size());
+        
+        // Roads inside the region, then waiting roads whose other city is
+        // loaded now
+        vector<RoadEdge> edges;
+        auto addEdge = [&](const PendingRoad& road) {
+            auto slot1 = slotByIndex.find(road.index1), slot2 = slotByIndex.find(road.index2);
+            if (slot1 == slotByIndex.end() || slot2 == slotByIndex.end() || slot1->second == slot2->second) {
+                return false;
+            }
+            edges.push_back(RoadEdge{slot1->second, slot2->second, road.budget, road.length});
+            return true;
+        };
+        for (const PendingRoad& road : inside) {
+            addEdge(road);
+        }
+        size_t insideCount = edges.size();
+        size_t kept = 0;
+        for (const PendingRoad& road : pendingRoads) {
+            if (!addEdge(road)) {
+                pendingRoads[kept++] = road;
+            }
+        }
+        pendingRoads.resize(kept);
+        roads.addRoads(edges);
+        roadsReplaced();
+        
+        cout << "Region " << regionLabel(region) << " loaded: " << cities.size() - firstSlot << " cities, "
+             << insideCount << " roads inside it and " << edges.size() - insideCount << " to other regions" << endl;
+    }
+
+    void loadAllRegions() {
+        for (size_t region = 0; region < regionLoaded.size(); region++) {
+            loadRegion(checkedCast<int>(region));
+        }
+    }
+
+    // Loads the regions of every city that has a road to this one
+    void loadNeighborRegions(int slot) {
+        int index = cities[slot].getIndex();
+        vector<int> wanted;
+        for (const PendingRoad& road : pendingRoads) {
+            if (road.index1 == index || road.index2 == index) {
+                auto stored = storedByIndex.find(road.index1 == index ? road.index2 : road.index1);
+                if (stored != storedByIndex.end()) {
+                    wanted.push_back(stored->second.region);
+                }
+            }
+        }
+        for (int region : wanted) {
+            loadRegion(region);
+        }
+    }
+
+    // Loads every region a route from a loaded city could pass through:
+    // afterwards no waiting road leads out of the loaded cities. Regions
+    // that no road reaches stay on disk.
+    void loadReachableRegions() {
+        size_t i = 0;
+        while (i < pendingRoads.size()) {
+            const PendingRoad& road = pendingRoads[i];
+            bool loaded1 = slotByIndex.count(road.index1) > 0;
+            bool loaded2 = slotByIndex.count(road.index2) > 0;
+            auto stored = loaded1 == loaded2 ? storedByIndex.end() : storedByIndex.find(loaded1 ? road.index2 : road.index1);
+            if (stored != storedByIndex.end() && !regionLoaded[stored->second.region]) {
+                loadRegion(stored->second.region);
+                i = 0;  // Loading changed the list
+            } else {
+                i++;
+            }
+        }
+    }
+
+    // Operations over the whole network first load any regions still on
+    // disk and squeeze out deleted cities
+    void prepareWholeNetwork() {
+        loadAllRegions();
+        compactCities();
+    }
+
+    // Writes the data stored by region: regions/<id>.txt with the cities of
+    // each loaded region and the roads inside it, regions/cross.txt with
+    // the roads between regions and regions/index.txt listing every city.
+    // Regions still on disk have not changed, so their files are kept.
+    bool saveRegions() {
+        // Cities added or moved to a region still on disk must be written
+        // together with the ones there
+        for (size_t i = 0; i < cities.size(); i++) {
+            loadRegion(cities[i].getRegion());
+        }
+        
+        vector<TextBuffer> shards(regionNames.size());
+        TextBuffer cross, index;
+        index.append("HIGHEST\t").append(highestIndex).newline();
+        for (size_t region = 0; region < regionNames.size(); region++) {
+            index.append("REGION\t").append(region).append("\t").append(regionNames[region]).newline();
+        }
+        for (size_t i = 0; i < cities.size(); i++) {
+            const City& city = cities[i];
+            index.append("CITY\t").append(city.getIndex()).append("\t").append(city.getRegion()).append("\t")
+                 .append(city.getName()).newline();
+            TextBuffer& shard = shards[city.getRegion()];
+            shard.append("CITY\t").append(city.getIndex()).append("\t").append(formatExact(city.getLatitude()))
+                 .append("\t").append(formatExact(city.getLongitude())).newline();
+            for (const Road& road : roads.neighbors(i)) {
+                if (road.neighbor > (int)i) {
+                    const City& other = cities[road.neighbor];
+                    appendStoredRoad(other.getRegion() == city.getRegion() ? shard : cross, city.getIndex(),
+                                     other.getIndex(), road.budget, road.length);
+                }
+            }
+        }
+        vector<int> storedIndices;
+        for (const auto& entry : storedByIndex) {
+            storedIndices.push_back(entry.first);
+        }
+        sort(storedIndices.begin(), storedIndices.end());
+        for (int stored : storedIndices) {
+            const StoredCity& city = storedByIndex[stored];
+            index.append("CITY\t").append(stored).append("\t").append(city.region).append("\t").append(city.name).newline();
+        }
+        for (const PendingRoad& road : pendingRoads) {
+            appendStoredRoad(cross, road.index1, road.index2, road.budget, road.length);
+        }
+        
+        size_t written = 0;
+        for (size_t region = 0; region < regionNames.size(); region++) {
+            if (regionLoaded[region]) {
+                if (!replaceFile(regionFile(checkedCast<int>(region)), shards[region])) {
+                    cout << "Error writing " << regionFile(checkedCast<int>(region)) << "!" << endl;
+                    return false;
+                }
+                written++;
+            }
+        }
+        // The index goes last: it is what marks the data as stored by region
+        if (!replaceFile("regions/cross.txt", cross) || !replaceFile("regions/index.txt", index)) {
+            cout << "Error writing regions/index.txt!" << endl;
+            return false;
+        }
+        cout << "Data saved to regions/ (" << written << " of " << regionNames.size() << " region files written)" << endl;
+        return true;
+    }
+
+    // Data stored by region is loaded lazily. Otherwise the binary snapshot
+    // is preferred; cities.txt and roads.txt are read when it is missing,
+    // damaged or older than them.
+    void loadDataFromFiles() {
+        resetRegions();
+        if (!loadRegionIndex()) {
+            if (!snapshotIsCurrent() || !loadSnapshot()) {
+                loadCitiesFromFile();
+                loadRoadsFromFile();
+            }
+        }
+        replayJournal();
+        // A saved hierarchy covers the whole network, which a session
+        // working region by region does not load
+        if (!sharded) {
+            loadHierarchy();
+        }
+        dataLoaded = true;
+    }
+
+    // roads.ch is only used if it was built for exactly the roads and
+    // budgets just loaded; otherwise it is rebuilt at exit
+    void loadHierarchy() {
+        struct stat info;
+        if (stat("roads.ch", &info) != 0) {
+            return;
+        }
+        hierarchyWanted = true;
+        auto loaded = make_shared<ContractionHierarchy>();
+        if (!loaded->load("roads.ch", roads)) {
+            cout << "roads.ch is out of date; it will be rebuilt at exit" << endl;
+            return;
+        }
+        hierarchy = loaded;
+        cout << "Route hierarchy loaded from roads.ch" << endl;
+    }
+
+    // Contracts the network and saves the result as roads.ch
+    void buildHierarchy() {
+        prepareWholeNetwork();  // The hierarchy covers every city
+        auto timer = stats.time(Operation::BuildHierarchy);
+        auto built = make_shared<ContractionHierarchy>();
+        built->build(roads);
+        hierarchy = built;
+        hierarchyWanted = true;
+        version++;  // So that the query server publishes a view using it
+        if (!built->save("roads.ch")) {
+            cout << "Error: Could not write roads.ch" << endl;
+        }
+    }
+
+    void prepareRouteQueries() {
+        auto start = chrono::steady_clock::now();
+        buildHierarchy();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        printDivider('=', 60);
+        printTitle("FAST CHEAPEST-ROUTE QUERIES", '=', 60);
+        printDivider('-', 60);
+        cout << "Cities: " << cities.size() << ", roads: " << roads.getRoadCount() << endl;
+        cout << "Shortcuts added: " << hierarchy->getShortcutCount() << endl;
+        cout << "Cities left uncontracted: " << hierarchy->getCoreSize() << endl;
+        cout << "Prepared in " << fixed << setprecision(3) << seconds << " s and saved to roads.ch" << endl;
+        cout << "Changes to roads or budgets drop it; it is rebuilt at exit." << endl;
+        printDivider('=', 60);
+    }
+
+    // Rewrites the data files from memory and starts a new, empty journal.
+    // If any file could not be written the journal is kept, since it still
+    // holds the changes the files are missing.
+    bool saveAllData() {
+        compactCities();  // The files and snapshot never hold deleted cities
+        auto timer = stats.time(Operation::SaveAll);
+        bool saved;
+        if (sharded) {
+            saved = saveRegions();
+        } else {
+            saved = saveCitiesToFile() && saveRoadsToFile() && saveSnapshot();
+        }
+        if (!saved) {
+            cout << "journal.log was kept, so no journaled change is lost." << endl;
+            return false;
+        }
+        journal.close();
+        ofstream emptyJournal("journal.log", ios::trunc);
+        journalEntries = 0;
+        return true;
+    }
+
+    // Rebuilds a hierarchy dropped by changes. Contracting a large network
+    // takes seconds, so this runs at exit rather than with every save.
+    void rebuildHierarchy() {
+        if (hierarchyWanted && !hierarchy) {
+            buildHierarchy();
+            cout << "Route hierarchy rebuilt and saved to roads.ch" << endl;
+        }
+    }
+
+    uint64_t getVersion() const { return version; }
+
+    // Copies everything the query server needs into a read-only view
+    shared_ptr<const NetworkView> makeView() {
+        prepareWholeNetwork();
+        ensureNetworks();
+        auto view = make_shared<NetworkView>();
+        view->version = version;
+        view->cities = cities;
+        view->roads = roads;
+        view->names = names;
+        view->slotByName = slotByName;
+        view->slotByIndex = slotByIndex;
+        view->geometry = ensureGeometry();
+        view->hierarchy = hierarchy;
+        view->network.resize(cities.size());
+        for (size_t i = 0; i < cities.size(); i++) {
+            view->network[i] = networks.find(checkedCast<int>(i));
+        }
+        return view;
+    }
+
+    // Switches to storage by region: from now on the data is saved under
+    // regions/, and later sessions load each region when it is first used
+    void storeByRegion() {
+        if (sharded) {
+            cout << "The data is already stored by region." << endl;
+            return;
+        }
+        if (mkdir("regions", 0755) != 0 && errno != EEXIST) {
+            cout << "Error: Could not create the regions directory" << endl;
+            return;
+        }
+        sharded = true;
+        saveAllData();
+        cout << "cities.txt, roads.txt and infrastructure.snap are no longer read or updated." << endl;
+    }
+
+    void displayRegions() {
+        vector<size_t> counts(regionNames.size(), 0);
+        for (const City& city : cities) {
+            if (!city.isDeleted()) {
+                counts[city.getRegion()]++;
+            }
+        }
+        for (const auto& entry : storedByIndex) {
+            counts[entry.second.region]++;
+        }
+        
+        printDivider('=', 60);
+        printTitle("REGIONS", '=', 60);
+        printDivider('-', 60);
+        cout << setw(6) << "NBR" << "  " << left << setw(30) << "REGION" << right << setw(10) << "CITIES"
+             << setw(12) << "LOADED" << endl;
+        printDivider('-', 60);
+        for (size_t region = 0; region < regionNames.size(); region++) {
+            cout << setw(6) << region + 1 << "  " << left << setw(30) << regionLabel(checkedCast<int>(region)) << right
+                 << setw(10) << counts[region] << setw(12) << (regionLoaded[region] ? "yes" : "no") << endl;
+        }
+        printDivider('-', 60);
+        cout << (sharded ? "Stored by region in regions/" : "Stored in cities.txt and roads.txt") << endl;
+        printDivider('=', 60);
+    }
+
+    void displayStatistics() const {
+        TextBuffer out;
+        out.append("Statistics collection is ").append(stats.isEnabled() ? "on" : "off").newline().newline();
+        stats.render(out);
+        out.newline().append("Route cache: ").append(routeCache.size()).append(" routes, ")
+           .append(routeCache.getHits()).append(" hits, ").append(routeCache.getMisses()).append(" misses, ")
+           .append(routeCache.getDropped()).append(" dropped after changes (epoch ")
+           .append(routeCache.getEpoch()).append(")").newline();
+        out.writeTo(cout);
+    }
+
+    void resetStatistics() {
+        stats.reset();
+        routeCache.resetCounters();
+    }
+    void setStatisticsEnabled(bool on) { stats.setEnabled(on); }
+    bool statisticsEnabled() const { return stats.isEnabled(); }
+
+    bool writeStatistics(const string& filename) const {
+        TextBuffer out;
+        stats.renderJson(out);
+        return out.writeToFile(filename);
+    }
+
+    // Called after each change: the change itself is already in the journal,
+    // so the data files are only rewritten once the journal gets long
+    void checkpoint() {
+        if (journalEntries >= JOURNAL_COMPACT_THRESHOLD) {
+            saveAllData();
+        }
+    }
+};
+
+
+
+#if !defined(INFRA_BENCHMARK) && !defined(INFRA_TEST)
+
+void displayMenu() {
+    system("clear"); // Clear the console on Linux/macOS
+    
+    printDivider('=', 60);
+    printTitle("RWANDA INFRASTRUCTURE MANAGEMENT SYSTEM", '=', 60);
+    printDivider('=', 60);
+    
+    cout << "\n" << setw(25) << "MAIN MENU" << "\n" << endl;
+    printDivider('-', 60);
+    
+    cout << "  1. Add new city(ies)" << endl;
+    cout << "  2. Add roads between cities" << endl;
+    cout << "  3. Add the budget for roads" << endl;
+    cout << "  4. Edit city" << endl;
+    cout << "  5. Search for a city using its index" << endl;
+    cout << "  6. Display cities" << endl;
+    cout << "  7. Display roads" << endl;
+    cout << "  8. Display recorded data on console" << endl;
+    cout << "  9. Exit" << endl;
+    cout << " 10. Find the cheapest route between two cities" << endl;
+    cout << " 11. Compute cheapest costs between all cities" << endl;
+    cout << " 12. Find the cheapest road network connecting all cities" << endl;
+    cout << " 13. View or export road data (paged, pager or file)" << endl;
+    cout << " 14. Compare the road connections of two cities" << endl;
+    cout << " 15. Show separate road networks" << endl;
+    cout << " 16. Show operation statistics" << endl;
+    cout << " 17. Budget analytics" << endl;
+    cout << " 18. Set a city's location or a road's length" << endl;
+    cout << " 19. Find the shortest route between two cities" << endl;
+    cout << " 20. Prepare fast cheapest-route queries" << endl;
+    cout << " 21. Delete a city or road" << endl;
+    cout << " 22. Regions (provinces)" << endl;
+    cout << " 23. Find critical roads and cities" << endl;
+    
+    printDivider('-', 60);
+    cout << "Enter your choice: ";
+}
+
+// Writes the operation statistics when --stats was given
+void dumpStatistics(const InfrastructureManagement& infra, const string& statsFile) {
+    if (statsFile.empty()) {
+        return;
+    }
+    if (infra.writeStatistics(statsFile)) {
+        cout << "Operation statistics saved to " << statsFile << endl;
+    } else {
+        cout << "Error opening " << statsFile << " for writing!" << endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    string batchFile;
+    string statsFile;
+    string socketPath;
+    bool validArguments = true;
+    for (int i = 1; i < argc; i += 2) {
+        string option = argv[i];
+        if (i + 1 < argc && option == "--batch") {
+            batchFile = argv[i + 1];
+        } else if (i + 1 < argc && option == "--stats") {
+            statsFile = argv[i + 1];
+        } else if (i + 1 < argc && option == "--serve") {
+            socketPath = argv[i + 1];
+        } else {
+            validArguments = false;
+        }
+    }
+    if (!validArguments || (!batchFile.empty() && !socketPath.empty())) {
+        cout << "Usage: " << argv[0] << " [--batch <command file> | --batch - | --serve <socket path>]"
+             << " [--stats <json file>]" << endl;
+        return 1;
+    }
+
+    // Batch mode: apply a command file (or "-" for standard input) and exit
+    if (!batchFile.empty()) {
+        InfrastructureManagement infra(!statsFile.empty());
+        bool applied = infra.runBatch(batchFile);
+        dumpStatistics(infra, statsFile);
+        return applied ? 0 : 1;
+    }
+    
+    // Display welcome message
+    system("clear");
+    printDivider('*', 70);
+    printTitle("WELCOME TO RWANDA INFRASTRUCTURE MANAGEMENT SYSTEM", '*', 70);
+    printTitle("Ministry of Infrastructure", '-', 70);
+    printDivider('*', 70);
+    cout << "\nThis system helps manage cities, roads, and budgets for Rwanda's infrastructure." << endl;
+    cout << "Press Enter to continue..." << endl;
+    cin.get();
+    
+    InfrastructureManagement infra(!statsFile.empty());
+    int choice;
+
+    // Server mode: analysts query a copy of the data over a socket while
+    // the menu below keeps editing; the copy is replaced after each change
+    QueryServer server;
+    uint64_t publishedVersion = infra.getVersion();
+    if (!socketPath.empty()) {
+        if (!server.start(socketPath, infra.makeView())) {
+            return 1;
+        }
+        cout << "Answering queries on " << socketPath << endl;
+        cout << "Press Enter to continue..." << endl;
+        cin.get();
+    }
+    auto publishChanges = [&]() {
+        if (!socketPath.empty() && infra.getVersion() != publishedVersion) {
+            server.publish(infra.makeView());
+            publishedVersion = infra.getVersion();
+        }
+    };
+    
+    do {
+        displayMenu();
+        
+        // Check if the input is a valid integer
+        if (!(cin >> choice)) {
+            // Clear the error state
+            cin.clear();
+            // Discard invalid input
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid input. Please enter a number." << endl;
+            continue;
+        }
+        
+        // Clear the input buffer
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        
+        switch (choice) {
+            case 1: {
+                printDivider('=', 60);
+                printTitle("ADD NEW CITIES", '=', 60);
+                printDivider('-', 60);
+                int numCities;
+                cout << "Enter the number of cities to add: ";
+                
+                // Check if the input is a valid integer
+                if (!(cin >> numCities)) {
+                    // Clear the error state
+                    cin.clear();
+                    // Discard invalid input
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    cout << "Invalid input. Please enter a number." << endl;
+                    break;
+                }
+                
+                // Validate the number of cities
+                if (numCities <= 0) {
+                    cout << "Please enter a positive number of cities." << endl;
+                    break;
+                }
+                
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                
+                vector<string> cityNames(numCities);
+                for (int i = 0; i < numCities; i++) {
+                    cout << "Enter name for city " << (i + 1) << ": ";
+                    getline(cin, cityNames[i]);
+                }
+                infra.addCities(cityNames);
+                
+                // The change is journaled; compact into the data files when needed
+                infra.checkpoint();
+                publishChanges();
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+            }
+            
+            case 2: {
+                printDivider('=', 60);
+                printTitle("ADD ROADS BETWEEN CITIES", '=', 60);
+                printDivider('-', 60);
+                string city1, city2;
+                cout << "Enter the name of the first city: ";
+                getline(cin, city1);
+                if (city1.empty()) {
+                    cout << "City name cannot be empty. Please try again." << endl;
+                    break;
+                }
+                
+                cout << "Enter the name of the second city: ";
+                getline(cin, city2);
+                if (city2.empty()) {
+                    cout << "City name cannot be empty. Please try again." << endl;
+                    break;
+                }
+                
+                infra.addRoad(city1, city2);
+                
+                // The change is journaled; compact into the data files when needed
+                infra.checkpoint();
+                publishChanges();
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+            }
+            
+            case 3: {
+                printDivider('=', 60);
+                printTitle("ADD BUDGET FOR ROADS", '=', 60);
+                printDivider('-', 60);
+                string city1, city2;
+                double budget;
+                
+                cout << "Enter the name of the first city: ";
+                getline(cin, city1);
+                if (city1.empty()) {
+                    cout << "City name cannot be empty. Please try again." << endl;
+                    break;
+                }
+                
+                cout << "Enter the name of the second city: ";
+                getline(cin, city2);
+                if (city2.empty()) {
+                    cout << "City name cannot be empty. Please try again." << endl;
+                    break;
+                }
+                
+                cout << "Enter the budget for that road: ";
+                if (!(cin >> budget)) {
+                    // Clear the error state
+                    cin.clear();
+                    // Discard invalid input
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    cout << "Invalid budget value. Please enter a number." << endl;
+                    break;
+                }
+                
+                if (budget <= 0) {
+                    cout << "Budget must be a positive number." << endl;
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    break;
+                }
+                
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                
+                infra.addBudget(city1, city2, budget);
+                
+                // The change is journaled; compact into the data files when needed
+                infra.checkpoint();
+                publishChanges();
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+            }
+            
             case 4: {
                 printDivider('=', 60);
                 printTitle("EDIT CITY", '=', 60);
                 printDivider('-', 60);
-                int index;
-                string newName;
+                int index;
+                string newName;
+                
+                cout << "Enter the index of the city to edit: ";
+                if (!(cin >> index)) {
+                    // Clear the error state
+                    cin.clear();
+                    // Discard invalid input
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    cout << "Invalid index. Please enter a number." << endl;
+                    break;
+                }
+                
+                if (index <= 0) {
+                    cout << "Index must be a positive number." << endl;
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    break;
+                }
+                
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                
+                cout << "Enter new name for city: ";
+                getline(cin, newName);
+                if (newName.empty()) {
+                    cout << "City name cannot be empty. Please try again." << endl;
+                    break;
+                }
+                
+                infra.editCity(index, newName);
+                
+                // The change is journaled; compact into the data files when needed
+                infra.checkpoint();
+                publishChanges();
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+            }
+            
+            case 5: {
+                printDivider('=', 60);
+                printTitle("SEARCH FOR A CITY", '=', 60);
+                printDivider('-', 60);
+                int index;
+                
+                cout << "Enter the index of the city to search: ";
+                if (!(cin >> index)) {
+                    // Clear the error state
+                    cin.clear();
+                    // Discard invalid input
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    cout << "Invalid index. Please enter a number." << endl;
+                    break;
+                }
+                
+                if (index <= 0) {
+                    cout << "Index must be a positive number." << endl;
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    break;
+                }
+                
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                
+                infra.searchCity(index);
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+            }
+            
+            case 6:
+                printDivider('=', 60);
+                printTitle("DISPLAY CITIES", '=', 60);
+                printDivider('-', 60);
+                infra.displayCities();
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+                
+            case 7:
+                printDivider('=', 60);
+                printTitle("DISPLAY ROADS", '=', 60);
+                printDivider('-', 60);
+                infra.displayRoads();
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+                
+            case 8:
+                printDivider('=', 60);
+                printTitle("DISPLAY ALL DATA", '=', 60);
+                printDivider('-', 60);
+                infra.displayAllData();
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+                
+            case 9:
+                printDivider('=', 60);
+                printTitle("EXITING PROGRAM", '=', 60);
+                printDivider('-', 60);
+                cout << "Exiting program. Goodbye!" << endl;
+                // Save all data before exiting
+                if (infra.saveAllData()) {
+                    infra.rebuildHierarchy();
+                }
+                dumpStatistics(infra, statsFile);
+                break;
+                
+            case 10: {
+                printDivider('=', 60);
+                printTitle("FIND CHEAPEST ROUTE", '=', 60);
+                printDivider('-', 60);
+                string city1, city2;
+                cout << "Enter the name of the starting city: ";
+                getline(cin, city1);
+                if (city1.empty()) {
+                    cout << "City name cannot be empty. Please try again." << endl;
+                    break;
+                }
+                
+                cout << "Enter the name of the destination city: ";
+                getline(cin, city2);
+                if (city2.empty()) {
+                    cout << "City name cannot be empty. Please try again." << endl;
+                    break;
+                }
+                
+                infra.findCheapestRoute(city1, city2);
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+            }
+                
+            case 11:
+                printDivider('=', 60);
+                printTitle("ALL-PAIRS CHEAPEST COSTS", '=', 60);
+                printDivider('-', 60);
+                infra.computeAllPairsCosts("cost_matrix.csv");
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+                
+            case 12:
+                printDivider('=', 60);
+                printTitle("MINIMUM-BUDGET ROAD NETWORK", '=', 60);
+                printDivider('-', 60);
+                infra.displayMinimumSpanningNetwork();
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
                 
-                cout << "Enter the index of the city to edit: ";
-                if (!(cin >> index)) {
+            case 13: {
+                printDivider('=', 60);
+                printTitle("VIEW OR EXPORT ROAD DATA", '=', 60);
+                printDivider('-', 60);
+                cout << "  1. Road list, page by page" << endl;
+                cout << "  2. Road list in the system pager" << endl;
+                cout << "  3. Save road list to a file" << endl;
+                cout << "  4. Save all data with matrices to a file" << endl;
+                printDivider('-', 60);
+                int view;
+                cout << "Enter your choice: ";
+                if (!(cin >> view) || view < 1 || view > 4) {
                     // Clear the error state
                     cin.clear();
                     // Discard invalid input
                     cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                    cout << "Invalid index. Please enter a number." << endl;
+                    cout << "Invalid choice. Please enter a number from 1 to 4." << endl;
                     break;
                 }
                 
-                if (index <= 0) {
-                    cout << "Index must be a positive number." << endl;
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                
+                if (view == 1) {
+                    infra.showReport(ReportView::Paged, false, "");
+                } else if (view == 2) {
+                    infra.showReport(ReportView::Pager, false, "");
+                } else {
+                    string filename;
+                    cout << "Enter the file name: ";
+                    getline(cin, filename);
+                    if (filename.empty()) {
+                        cout << "File name cannot be empty. Please try again." << endl;
+                        break;
+                    }
+                    infra.showReport(ReportView::File, view == 4, filename);
+                }
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+            }
+                
+            case 14: {
+                printDivider('=', 60);
+                printTitle("COMPARE ROAD CONNECTIONS", '=', 60);
+                printDivider('-', 60);
+                string city1, city2;
+                cout << "Enter the name of the first city: ";
+                getline(cin, city1);
+                if (city1.empty()) {
+                    cout << "City name cannot be empty. Please try again." << endl;
+                    break;
+                }
+                
+                cout << "Enter the name of the second city: ";
+                getline(cin, city2);
+                if (city2.empty()) {
+                    cout << "City name cannot be empty. Please try again." << endl;
+                    break;
+                }
+                
+                infra.compareCities(city1, city2);
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+            }
+                
+            case 15:
+                printDivider('=', 60);
+                printTitle("SEPARATE ROAD NETWORKS", '=', 60);
+                printDivider('-', 60);
+                infra.displayNetworks();
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+                
+            case 16: {
+                printDivider('=', 60);
+                printTitle("OPERATION STATISTICS", '=', 60);
+                printDivider('-', 60);
+                infra.displayStatistics();
+                cout << "\nEnter r to reset, t to turn collection "
+                     << (infra.statisticsEnabled() ? "off" : "on") << ", or press Enter to continue: ";
+                string answer;
+                getline(cin, answer);
+                if (answer == "r" || answer == "R") {
+                    infra.resetStatistics();
+                    cout << "Statistics reset." << endl;
+                } else if (answer == "t" || answer == "T") {
+                    infra.setStatisticsEnabled(!infra.statisticsEnabled());
+                    cout << "Statistics collection turned " << (infra.statisticsEnabled() ? "on." : "off.") << endl;
+                }
+                break;
+            }
+                
+            case 17: {
+                printDivider('=', 60);
+                printTitle("BUDGET ANALYTICS", '=', 60);
+                printDivider('-', 60);
+                cout << "  1. Most expensive roads" << endl;
+                cout << "  2. Roads with budgets in a range" << endl;
+                cout << "  3. Total budget of a city's roads" << endl;
+                cout << "Enter your choice: ";
+                int analysis;
+                if (!(cin >> analysis)) {
+                    cin.clear();
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    cout << "Invalid input. Please enter a number." << endl;
+                    break;
+                }
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                
+                if (analysis == 1) {
+                    int count;
+                    cout << "How many roads: ";
+                    if (!(cin >> count) || count <= 0) {
+                        cin.clear();
+                        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                        cout << "Please enter a positive number of roads." << endl;
+                        break;
+                    }
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    infra.displayTopBudgets(count);
+                } else if (analysis == 2) {
+                    double low, high;
+                    cout << "Enter the lowest budget (billion RWF): ";
+                    if (!(cin >> low)) {
+                        cin.clear();
+                        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                        cout << "Invalid budget. Please enter a number." << endl;
+                        break;
+                    }
+                    cout << "Enter the highest budget (billion RWF): ";
+                    if (!(cin >> high)) {
+                        cin.clear();
+                        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                        cout << "Invalid budget. Please enter a number." << endl;
+                        break;
+                    }
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    infra.displayBudgetRange(low, high);
+                } else if (analysis == 3) {
+                    string city;
+                    cout << "Enter the name of the city: ";
+                    getline(cin, city);
+                    infra.displayCityBudgetTotal(city);
+                } else {
+                    cout << "Invalid choice." << endl;
+                    break;
+                }
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+            }
+                
+            case 18: {
+                printDivider('=', 60);
+                printTitle("LOCATIONS AND ROAD LENGTHS", '=', 60);
+                printDivider('-', 60);
+                cout << "  1. Set the location of a city" << endl;
+                cout << "  2. Set the length of a road" << endl;
+                cout << "Enter your choice: ";
+                int what;
+                if (!(cin >> what) || (what != 1 && what != 2)) {
+                    cin.clear();
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    cout << "Invalid choice." << endl;
+                    break;
+                }
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                
+                string city1, city2;
+                cout << (what == 1 ? "Enter the name of the city: " : "Enter the name of the first city: ");
+                getline(cin, city1);
+                if (city1.empty()) {
+                    cout << "City name cannot be empty. Please try again." << endl;
+                    break;
+                }
+                if (what == 2) {
+                    cout << "Enter the name of the second city: ";
+                    getline(cin, city2);
+                    if (city2.empty()) {
+                        cout << "City name cannot be empty. Please try again." << endl;
+                        break;
+                    }
+                }
+                
+                double first, second = 0.0;
+                cout << (what == 1 ? "Enter the latitude (degrees, south is negative): " : "Enter the length in km: ");
+                bool valid = (bool)(cin >> first);
+                if (valid && what == 1) {
+                    cout << "Enter the longitude (degrees, west is negative): ";
+                    valid = (bool)(cin >> second);
+                }
+                if (!valid) {
+                    cin.clear();
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    cout << "Invalid value. Please enter a number." << endl;
+                    break;
+                }
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                
+                if (what == 1) {
+                    infra.setCityLocation(city1, first, second);
+                } else {
+                    infra.setRoadLength(city1, city2, first);
+                }
+                
+                // The change is journaled; compact into the data files when needed
+                infra.checkpoint();
+                publishChanges();
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+            }
+                
+            case 19: {
+                printDivider('=', 60);
+                printTitle("FIND SHORTEST ROUTE", '=', 60);
+                printDivider('-', 60);
+                string city1, city2;
+                cout << "Enter the name of the starting city: ";
+                getline(cin, city1);
+                if (city1.empty()) {
+                    cout << "City name cannot be empty. Please try again." << endl;
+                    break;
+                }
+                
+                cout << "Enter the name of the destination city: ";
+                getline(cin, city2);
+                if (city2.empty()) {
+                    cout << "City name cannot be empty. Please try again." << endl;
+                    break;
+                }
+                
+                infra.findShortestRoute(city1, city2);
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+            }
+                
+            case 20:
+                infra.prepareRouteQueries();
+                publishChanges();
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+                
+            case 21: {
+                printDivider('=', 60);
+                printTitle("DELETE A CITY OR ROAD", '=', 60);
+                printDivider('-', 60);
+                cout << "  1. Delete a city and its roads" << endl;
+                cout << "  2. Delete a road" << endl;
+                cout << "Enter your choice: ";
+                int what;
+                if (!(cin >> what) || (what != 1 && what != 2)) {
+                    cin.clear();
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    cout << "Invalid choice." << endl;
+                    break;
+                }
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                
+                string city1, city2;
+                cout << (what == 1 ? "Enter the name of the city: " : "Enter the name of the first city: ");
+                getline(cin, city1);
+                if (city1.empty()) {
+                    cout << "City name cannot be empty. Please try again." << endl;
+                    break;
+                }
+                if (what == 2) {
+                    cout << "Enter the name of the second city: ";
+                    getline(cin, city2);
+                    if (city2.empty()) {
+                        cout << "City name cannot be empty. Please try again." << endl;
+                        break;
+                    }
+                    infra.deleteRoad(city1, city2);
+                } else {
+                    infra.deleteCity(city1);
+                }
+                
+                // The change is journaled; compact into the data files when needed
+                infra.checkpoint();
+                publishChanges();
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+            }
+                
+            case 22: {
+                printDivider('=', 60);
+                printTitle("REGIONS", '=', 60);
+                printDivider('-', 60);
+                cout << "  1. Set the region of a city" << endl;
+                cout << "  2. List regions" << endl;
+                cout << "  3. Store data by region (load each region when it is used)" << endl;
+                cout << "Enter your choice: ";
+                int what;
+                if (!(cin >> what) || what < 1 || what > 3) {
+                    cin.clear();
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    cout << "Invalid choice." << endl;
+                    break;
+                }
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                
+                if (what == 1) {
+                    string city, region;
+                    cout << "Enter the name of the city: ";
+                    getline(cin, city);
+                    if (city.empty()) {
+                        cout << "City name cannot be empty. Please try again." << endl;
+                        break;
+                    }
+                    cout << "Enter the region: ";
+                    getline(cin, region);
+                    infra.setCityRegion(city, region);
+                    infra.checkpoint();
+                } else if (what == 2) {
+                    infra.displayRegions();
+                } else {
+                    infra.storeByRegion();
+                }
+                publishChanges();
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+            }
+                
+            case 23: {
+                int count;
+                cout << "How many roads and cities to list: ";
+                if (!(cin >> count) || count <= 0) {
+                    cin.clear();
                     cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    cout << "Please enter a positive number." << endl;
                     break;
                 }
-                
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                
-                cout << "Enter new name for city: ";
-                getline(cin, newName);
-                if (newName.empty()) {
-                    cout << "City name cannot be empty. Please try again." << endl;
-                    break;
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                infra.displayCriticalInfrastructure(count);
+                cout << "\nPress Enter to continue..." << endl;
+                cin.get();
+                break;
+            }
+                
+            default:
+                cout << "Invalid choice. Please try again." << endl;
+        }
+        
+    } while (choice != 9);
+    
+    return 0;
+}
+
+#endif // !INFRA_BENCHMARK && !INFRA_TEST
+
+#if defined(INFRA_BENCHMARK) && defined(INFRA_TEST)
+#error "Build the benchmarks and the tests separately"
+#endif
+
+#if defined(INFRA_BENCHMARK) || defined(INFRA_TEST)
+
+// ---------------------------------------------------------------------------
+// Benchmark build
+//
+//   g++ -std=c++20 -O2 -march=native -pthread -DINFRA_BENCHMARK
+//       infrastructure_management.cpp -o infrastructure_benchmark
+//   ./infrastructure_benchmark [--sizes 1000,10000,100000]
+//       [--kinds grid,geometric,scalefree] [--reps 5] [--seed 42]
+//       [--report benchmark.json]
+//
+// For every network kind and size a synthetic network is generated and
+// written as cities.txt/roads.txt in a scratch directory, then each
+// InfrastructureManagement operation is timed. Results are printed as a
+// table and written as JSON so runs can be compared. The test build at the
+// end of this file uses the same generated networks.
+// ---------------------------------------------------------------------------
+
+#include <filesystem>
+#include <random>
+
+// Deterministic road networks shaped like real ones
+class SyntheticNetwork {
+private:
+    vector<string> names;
+    vector<pair<double, double>> locations;  // Latitude, longitude; geometric networks only
+    RoadGraph graph;
+
+    // Pronounceable, unique names: the city number written in base 16 with
+    // a syllable per digit
+    static string cityName(size_t number) {
+        static const char* syllables[16] = {"ka", "ki", "ru", "nya", "ga", "bu", "mu", "ha",
+                                            "ge", "ra", "to", "se", "li", "wa", "ma", "zi"};
+        string name;
+        do {
+            name.insert(0, syllables[number % 16]);
+            number /= 16;
+        } while (number > 0);
+        name[0] = static_cast<char>(toupper(static_cast<unsigned char>(name[0])));
+        return name;
+    }
+
+    // Square grid, each city joined to the ones to its right and below
+    void makeGrid(size_t n, mt19937_64& rng) {
+        size_t side = max<size_t>(1, (size_t)ceil(sqrt((double)n)));
+        uniform_real_distribution<double> budget(10.0, 100.0);
+        vector<RoadEdge> edges;
+        for (size_t i = 0; i < n; i++) {
+            if ((i + 1) % side != 0 && i + 1 < n) {
+                edges.push_back(RoadEdge{(int)i, (int)i + 1, budget(rng)});
+            }
+            if (i + side < n) {
+                edges.push_back(RoadEdge{(int)i, (int)(i + side), budget(rng)});
+            }
+        }
+        graph.addRoads(edges);
+    }
+
+    // Cities scattered over a square, each joined to its three nearest
+    // neighbors; budgets grow with distance
+    void makeGeometric(size_t n, mt19937_64& rng) {
+        uniform_real_distribution<double> coordinate(0.0, 1.0);
+        vector<double> x(n), y(n);
+        for (size_t i = 0; i < n; i++) {
+            x[i] = coordinate(rng);
+            y[i] = coordinate(rng);
+        }
+
+        // Spread over a box about the size of Rwanda, so routing can use
+        // the locations
+        locations.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            locations[i] = {-2.84 + y[i] * 1.79, 28.86 + x[i] * 2.04};
+        }
+
+        // Bucket the cities in a grid of cells holding about two cities each
+        size_t cellsPerSide = max<size_t>(1, (size_t)sqrt(static_cast<double>(n) / 2.0));
+        vector<vector<int>> cells(cellsPerSide * cellsPerSide);
+        auto cellOf = [&](double v) { return min(cellsPerSide - 1, (size_t)(v * static_cast<double>(cellsPerSide))); };
+        for (size_t i = 0; i < n; i++) {
+            cells[cellOf(y[i]) * cellsPerSide + cellOf(x[i])].push_back(checkedCast<int>(i));
+        }
+
+        vector<RoadEdge> edges;
+        vector<pair<double, int>> nearby;
+        for (size_t i = 0; i < n; i++) {
+            nearby.clear();
+            long cx = cellOf(x[i]), cy = cellOf(y[i]);
+            for (long dy = -1; dy <= 1; dy++) {
+                for (long dx = -1; dx <= 1; dx++) {
+                    long nx = cx + dx, ny = cy + dy;
+                    if (nx < 0 || ny < 0 || nx >= (long)cellsPerSide || ny >= (long)cellsPerSide) {
+                        continue;
+                    }
+                    for (int j : cells[ny * cellsPerSide + nx]) {
+                        if (j != (int)i) {
+                            nearby.push_back({hypot(x[i] - x[j], y[i] - y[j]), j});
+                        }
+                    }
+                }
+            }
+            size_t keep = min<size_t>(3, nearby.size());
+            partial_sort(nearby.begin(), nearby.begin() + keep, nearby.end());
+            for (size_t k = 0; k < keep; k++) {
+                edges.push_back(RoadEdge{(int)i, nearby[k].second, 5.0 + nearby[k].first * 500.0});
+            }
+        }
+        graph.addRoads(edges);
+    }
+
+    // Preferential attachment: each new city links to two existing cities,
+    // picked in proportion to how many roads they already have
+    void makeScaleFree(size_t n, mt19937_64& rng) {
+        uniform_real_distribution<double> budget(10.0, 100.0);
+        vector<RoadEdge> edges;
+        vector<int> endpoints;
+        for (size_t i = 1; i < n; i++) {
+            for (int link = 0; link < 2; link++) {
+                int target = endpoints.empty() ? 0 : endpoints[rng() % endpoints.size()];
+                if (target == (int)i) {
+                    continue;
+                }
+                edges.push_back(RoadEdge{(int)i, target, budget(rng)});
+                endpoints.push_back(checkedCast<int>(i));
+                endpoints.push_back(target);
+            }
+        }
+        graph.addRoads(edges);
+    }
+
+public:
+    SyntheticNetwork(const string& kind, size_t n, uint64_t seed) {
+        mt19937_64 rng(seed);
+        names.reserve(n);
+        for (size_t i = 1; i <= n; i++) {
+            names.push_back(cityName(i));
+        }
+        graph.resize(n);
+        if (kind == "grid") {
+            makeGrid(n, rng);
+        } else if (kind == "geometric") {
+            makeGeometric(n, rng);
+        } else {
+            makeScaleFree(n, rng);
+        }
+    }
+
+    const vector<string>& getNames() const { return names; }
+    size_t getRoadCount() const { return graph.getRoadCount(); }
+
+    // Writes cities.txt and roads.txt in the same format the program saves
+    void writeFiles() const {
+        TextBuffer citiesText;
+        citiesText.append(locations.empty() ? "Index\tCity_name\n" : "Index\tCity_name\tLatitude\tLongitude\n");
+        for (size_t i = 0; i < names.size(); i++) {
+            citiesText.append((long long)i + 1).append("\t").append(names[i]);
+            if (!locations.empty()) {
+                citiesText.append("\t").padLeft(locations[i].first, 0, 6).append("\t").padLeft(locations[i].second, 0, 6);
+            }
+            citiesText.newline();
+        }
+        citiesText.writeToFile("cities.txt");
+
+        TextBuffer roadsText;
+        roadsText.append("Nbr\tRoad\t\t\tBudget\n");
+        long long number = 0;
+        for (const RoadEdge& edge : graph.edgeList()) {
+            char budget[32];
+            auto result = to_chars(budget, budget + sizeof(budget), edge.budget, chars_format::fixed, 2);
+            roadsText.append(++number).append(".\t").append(names[edge.city1]).append("-").append(names[edge.city2]);
+            roadsText.append("\t\t").append(string_view(budget, result.ptr - budget)).newline();
+        }
+        roadsText.writeToFile("roads.txt");
+    }
+};
+
+// Swallows output while operations that print are being timed
+class NullBuffer : public streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    streamsize xsputn(const char*, streamsize count) override { return count; }
+};
+
+#endif // INFRA_BENCHMARK || INFRA_TEST
+
+#ifdef INFRA_BENCHMARK
+
+class Benchmark {
+private:
+    struct Result {
+        string network;
+        size_t cities;
+        size_t roads;
+        string operation;
+        vector<double> seconds;
+    };
+
+    vector<Result> results;
+    size_t repetitions;
+    uint64_t seed;
+    NullBuffer nullBuffer;
+    streambuf* consoleBuffer;
+
+    void quiet() { consoleBuffer = cout.rdbuf(&nullBuffer); }
+    void loud() { cout.rdbuf(consoleBuffer); }
+
+    template <typename Operation>
+    static double timeOnce(Operation operation) {
+        auto start = chrono::steady_clock::now();
+        operation();
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    static double percentile(const vector<double>& sorted, double p) {
+        size_t position = min(sorted.size() - 1, (size_t)(p * static_cast<double>(sorted.size())));
+        return sorted[position];
+    }
+
+    void record(const string& network, size_t cities, size_t roads, const string& operation, vector<double> seconds) {
+        sort(seconds.begin(), seconds.end());
+        results.push_back(Result{network, cities, roads, operation, move(seconds)});
+        const Result& r = results.back();
+        double mean = accumulate(r.seconds.begin(), r.seconds.end(), 0.0) / static_cast<double>(r.seconds.size());
+        cout << setw(10) << network << setw(9) << cities << setw(22) << operation << setw(8) << r.seconds.size()
+             << fixed << setprecision(2) << setw(12) << mean * 1e6 << setw(12) << percentile(r.seconds, 0.5) * 1e6
+             << setw(12) << percentile(r.seconds, 0.9) * 1e6 << setw(12) << percentile(r.seconds, 0.99) * 1e6 << endl;
+    }
+
+    void runNetwork(const string& kind, size_t n) {
+        SyntheticNetwork network(kind, n, seed);
+        network.writeFiles();
+        remove("roads.ch");
+        size_t roads = network.getRoadCount();
+        const vector<string>& names = network.getNames();
+        mt19937_64 rng(seed + n);
+
+        quiet();
+
+        // Loading from text (no snapshot or journal present)
+        vector<double> samples;
+        for (size_t r = 0; r < repetitions; r++) {
+            remove("infrastructure.snap");
+            remove("journal.log");
+            samples.push_back(timeOnce([] { InfrastructureManagement infra; }));
+        }
+        loud();
+        record(kind, n, roads, "loadDataFromFiles", samples);
+        quiet();
+
+        InfrastructureManagement infra;
+
+        // Single-name lookups of random existing cities
+        size_t lookups = min<size_t>(100000, n * 10);
+        samples.clear();
+        samples.reserve(lookups);
+        volatile int sink = 0;
+        for (size_t i = 0; i < lookups; i++) {
+            const string& name = names[rng() % n];
+            samples.push_back(timeOnce([&] { sink = sink + infra.findCityIndexByName(name); }));
+        }
+        loud();
+        record(kind, n, roads, "findCityIndexByName", samples);
+        quiet();
+
+        // Individual additions, as the menu makes them (each is journaled)
+        size_t additions = min<size_t>(10000, n);
+        samples.clear();
+        for (size_t i = 0; i < additions; i++) {
+            string name = "Bench City " + to_string(i);
+            samples.push_back(timeOnce([&] { infra.addCity(name); }));
+        }
+        loud();
+        record(kind, n, roads, "addCity", samples);
+        quiet();
+
+        samples.clear();
+        for (size_t i = 0; i < additions; i++) {
+            const string& a = names[rng() % n];
+            const string& b = names[rng() % n];
+            samples.push_back(timeOnce([&] { infra.addRoad(a, b); }));
+        }
+        loud();
+        record(kind, n, roads, "addRoad", samples);
+        quiet();
+
+        samples.clear();
+        for (size_t r = 0; r < repetitions; r++) {
+            samples.push_back(timeOnce([&] { infra.saveAllData(); }));
+        }
+        loud();
+        record(kind, n, roads, "saveAllData", samples);
+        quiet();
+
+        samples.clear();
+        for (size_t r = 0; r < repetitions; r++) {
+            samples.push_back(timeOnce([&] { infra.displayCities(); }));
+        }
+        loud();
+        record(kind, n, roads, "displayCities", samples);
+        quiet();
+
+        // The matrix views grow with the square of the city count
+        if (n <= 5000) {
+            samples.clear();
+            for (size_t r = 0; r < repetitions; r++) {
+                samples.push_back(timeOnce([&] { infra.displayAllData(); }));
+            }
+            loud();
+            record(kind, n, roads, "displayAllData", samples);
+            quiet();
+        }
+
+        size_t routes = min<size_t>(100, n);
+        vector<pair<string, string>> ends;
+        for (size_t i = 0; i < routes; i++) {
+            ends.push_back({names[rng() % n], names[rng() % n]});
+        }
+        samples.clear();
+        vector<int> path;
+        double cost;
+        for (const auto& [a, b] : ends) {
+            samples.push_back(timeOnce([&] { infra.getCheapestRoute(a, b, path, cost); }));
+        }
+        loud();
+        record(kind, n, roads, "getCheapestRoute", samples);
+        quiet();
+
+        // The same routes over the generated network alone (the random
+        // roads added above have no budget), then over its contraction
+        // hierarchy
+        network.writeFiles();
+        remove("infrastructure.snap");
+        remove("journal.log");
+        InfrastructureManagement generated;
+        samples.clear();
+        for (const auto& [a, b] : ends) {
+            samples.push_back(timeOnce([&] { generated.getCheapestRoute(a, b, path, cost); }));
+        }
+        loud();
+        record(kind, n, roads, "cheapestRoute gen", samples);
+        quiet();
+
+        samples.clear();
+        samples.push_back(timeOnce([&] { generated.buildHierarchy(); }));
+        loud();
+        record(kind, n, roads, "buildHierarchy", samples);
+        quiet();
+
+        samples.clear();
+        generated.routeCache.clear();
+        for (const auto& [a, b] : ends) {
+            samples.push_back(timeOnce([&] { generated.getCheapestRoute(a, b, path, cost); }));
+        }
+        loud();
+        record(kind, n, roads, "cheapestRoute gen CH", samples);
+        quiet();
+
+        // Asked again, they come from the route cache
+        samples.clear();
+        for (const auto& [a, b] : ends) {
+            samples.push_back(timeOnce([&] { generated.getCheapestRoute(a, b, path, cost); }));
+        }
+        loud();
+        record(kind, n, roads, "cheapestRoute cached", samples);
+        quiet();
+
+        samples.clear();
+        for (size_t r = 0; r < repetitions; r++) {
+            CriticalInfrastructure analysis;
+            samples.push_back(timeOnce([&] { analysis.compute(generated.roads); }));
+        }
+        loud();
+        record(kind, n, roads, "criticalRoads gen", samples);
+        remove("roads.ch");
+    }
+
+public:
+    Benchmark(size_t runs, uint64_t baseSeed) : repetitions(runs), seed(baseSeed), consoleBuffer(nullptr) {}
+
+    void run(const vector<string>& kinds, const vector<size_t>& sizes) {
+        cout << setw(10) << "NETWORK" << setw(9) << "CITIES" << setw(22) << "OPERATION" << setw(8) << "RUNS"
+             << setw(12) << "MEAN us" << setw(12) << "P50 us" << setw(12) << "P90 us" << setw(12) << "P99 us" << endl;
+        printDivider('-', 97);
+        for (const string& kind : kinds) {
+            for (size_t n : sizes) {
+                runNetwork(kind, n);
+            }
+        }
+    }
+
+    bool writeReport(const string& filename) const {
+        ofstream file(filename);
+        if (!file.is_open()) {
+            return false;
+        }
+        file << "[\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            double mean = accumulate(r.seconds.begin(), r.seconds.end(), 0.0) / static_cast<double>(r.seconds.size());
+            file << "  {\"network\": \"" << r.network << "\", \"cities\": " << r.cities
+                 << ", \"roads\": " << r.roads << ", \"operation\": \"" << r.operation
+                 << "\", \"runs\": " << r.seconds.size() << fixed << setprecision(3)
+                 << ", \"mean_us\": " << mean * 1e6
+                 << ", \"min_us\": " << r.seconds.front() * 1e6
+                 << ", \"p50_us\": " << percentile(r.seconds, 0.5) * 1e6
+                 << ", \"p90_us\": " << percentile(r.seconds, 0.9) * 1e6
+                 << ", \"p99_us\": " << percentile(r.seconds, 0.99) * 1e6
+                 << ", \"max_us\": " << r.seconds.back() * 1e6 << "}"
+                 << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        file << "]\n";
+        return (bool)file;
+    }
+};
+
+// Parses a whole command-line value as an unsigned number
+static bool parseCount(const string& text, uint64_t& value) {
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == errc() && result.ptr == text.data() + text.size() && !text.empty();
+}
+
+int main(int argc, char* argv[]) {
+    vector<size_t> sizes = {1000, 10000, 100000};
+    vector<string> kinds = {"grid", "geometric", "scalefree"};
+    size_t repetitions = 5;
+    uint64_t seed = 42;
+    string report = "benchmark.json";
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string option = argv[i];
+        vector<string> values;
+        string_view list = argv[i + 1];
+        while (!list.empty()) {
+            size_t comma = list.find(',');
+            values.push_back(string(list.substr(0, comma)));
+            list.remove_prefix(comma == string_view::npos ? list.size() : comma + 1);
+        }
+        uint64_t number;
+        if (option == "--sizes") {
+            sizes.clear();
+            for (const string& value : values) {
+                if (!parseCount(value, number) || number == 0) {
+                    cout << "Invalid network size '" << value << "'" << endl;
+                    return 1;
+                }
+                sizes.push_back(number);
+            }
+        } else if (option == "--kinds") {
+            kinds = values;
+        } else if (option == "--reps") {
+            if (values.size() != 1 || !parseCount(values[0], number)) {
+                cout << "Invalid repetition count '" << argv[i + 1] << "'" << endl;
+                return 1;
+            }
+            repetitions = max<uint64_t>(1, number);
+        } else if (option == "--seed") {
+            if (values.size() != 1 || !parseCount(values[0], seed)) {
+                cout << "Invalid seed '" << argv[i + 1] << "'" << endl;
+                return 1;
+            }
+        } else if (option == "--report") {
+            report = argv[i + 1];
+        } else {
+            cout << "Unknown option " << option << endl;
+            return 1;
+        }
+    }
+    for (const string& kind : kinds) {
+        if (kind != "grid" && kind != "geometric" && kind != "scalefree") {
+            cout << "Unknown network kind '" << kind << "' (use grid, geometric or scalefree)" << endl;
+            return 1;
+        }
+    }
+
+    // Work in a scratch directory so real data files are never touched
+    filesystem::path start = filesystem::current_path();
+    filesystem::path reportPath = filesystem::absolute(report);
+    filesystem::path scratch = filesystem::temp_directory_path() / ("infrastructure-benchmark-" + to_string(getpid()));
+    filesystem::create_directories(scratch);
+    filesystem::current_path(scratch);
+
+    Benchmark benchmark(repetitions, seed);
+    benchmark.run(kinds, sizes);
+
+    filesystem::current_path(start);
+    filesystem::remove_all(scratch);
+
+    if (!benchmark.writeReport(reportPath.string())) {
+        cout << "Error opening " << reportPath.string() << " for writing!" << endl;
+        return 1;
+    }
+    cout << "Report saved to " << reportPath.string() << endl;
+    return 0;
+}
+
+#endif // INFRA_BENCHMARK
+
+#ifdef INFRA_TEST
+
+// ---------------------------------------------------------------------------
+// Test build
+//
+//   g++ -std=c++20 -O2 -pthread -DINFRA_TEST
+//       infrastructure_management.cpp -o infrastructure_tests
+//   ./infrastructure_tests
+//
+// Checks journal replay, the snapshot, the route hierarchy and route cache,
+// city tombstones, storage by region and the critical-road search against
+// simple reference answers. Each test runs in its own scratch directory.
+// Every failed expectation is printed and the exit status is 1 if any failed.
+// ---------------------------------------------------------------------------
+
+#include <map>
+
+class SelfTest {
+private:
+    // Everything the data files hold, keyed by public index so that two
+    // sessions can be compared whatever slots they use
+    struct Contents {
+        map<int, array<string, 4>> cities;                // Name, region, latitude, longitude
+        map<pair<int, int>, pair<string, string>> roads;  // Budget, length
+        int highestIndex = 0;
+
+        bool operator==(const Contents&) const = default;
+    };
+
+    NullBuffer nullBuffer;
+    string test;
+    size_t checks;
+    vector<string> failures;
+
+    void expect(bool ok, const string& what) {
+        checks++;
+        if (!ok) {
+            failures.push_back(test + ": " + what);
+        }
+    }
+
+    static bool sameCost(double a, double b) {
+        return fabs(a - b) <= 1e-9 * max(1.0, fabs(b));
+    }
+
+    static string readFile(const string& filename) {
+        ifstream file(filename, ios::binary);
+        return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    }
+
+    static void writeFile(const string& filename, const string& bytes) {
+        ofstream file(filename, ios::binary | ios::trunc);
+        file.write(bytes.data(), checkedCast<streamsize>(bytes.size()));
+    }
+
+    // Loads every region and squeezes out deleted cities first
+    static Contents contentsOf(InfrastructureManagement& infra) {
+        infra.prepareWholeNetwork();
+        Contents contents;
+        contents.highestIndex = infra.highestIndex;
+        for (size_t i = 0; i < infra.cities.size(); i++) {
+            const City& city = infra.cities[i];
+            contents.cities[city.getIndex()] = {string(city.getName()), infra.regionNames[city.getRegion()],
+                                                InfrastructureManagement::formatExact(city.getLatitude()),
+                                                InfrastructureManagement::formatExact(city.getLongitude())};
+            for (const Road& road : infra.roads.neighbors(i)) {
+                int other = infra.cities[road.neighbor].getIndex();
+                if (city.getIndex() < other) {
+                    contents.roads[{city.getIndex(), other}] = {InfrastructureManagement::formatExact(road.budget),
+                                                                 InfrastructureManagement::formatExact(road.length)};
                 }
-                
-                infra.editCity(index, newName);
-                
-                // Save data after editing a city
-                infra.saveAllData();
-                cout << "\nPress Enter to continue..." << endl;
-                cin.get();
-                break;
             }
-            
-            case 5: {
-                printDivider('=', 60);
-                printTitle("SEARCH FOR A CITY", '=', 60);
-                printDivider('-', 60);
-                int index;
-                
-                cout << "Enter the index of the city to search: ";
-                if (!(cin >> index)) {
-                    // Clear the error state
-                    cin.clear();
-                    // Discard invalid input
-                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                    cout << "Invalid index. Please enter a number." << endl;
-                    break;
+        }
+        return contents;
+    }
+
+    static vector<string> loadedRegions(const InfrastructureManagement& infra) {
+        vector<string> loaded;
+        for (size_t region = 1; region < infra.regionLoaded.size(); region++) {
+            if (infra.regionLoaded[region]) {
+                loaded.push_back(infra.regionNames[region]);
+            }
+        }
+        return loaded;
+    }
+
+    // Adds cities spread over regions "Region 0", "Region 1", ... in turn,
+    // with roads only between cities of the same region. Most cities get a
+    // location, most roads a budget and some a length. Locations are whole
+    // micro-degrees, the precision cities.txt keeps.
+    static void populate(InfrastructureManagement& infra, size_t count, size_t regionCount, mt19937_64& rng) {
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        auto microDegrees = [](double degrees) { return round(degrees * 1e6) / 1e6; };
+        size_t first = infra.cities.size();
+        for (size_t i = 0; i < count; i++) {
+            int index = infra.nextCityIndex();
+            infra.applyAddCity("Town " + to_string(index), index);
+            int slot = checkedCast<int>(infra.cities.size() - 1);
+            if (rng() % 4 != 0) {
+                infra.applySetLocation(slot, microDegrees(-2.84 + unit(rng) * 1.79), microDegrees(28.86 + unit(rng) * 2.04));
+            }
+            infra.applySetRegion(slot, infra.regionId("Region " + to_string(i % regionCount)));
+        }
+        for (size_t i = first; i < infra.cities.size(); i++) {
+            for (int link = 0; link < 2; link++) {
+                size_t back = regionCount * (1 + rng() % 3);
+                if (i < first + back) {
+                    continue;
                 }
-                
-                if (index <= 0) {
-                    cout << "Index must be a positive number." << endl;
-                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                    break;
+                int a = checkedCast<int>(i), b = checkedCast<int>(i - back);
+                if (!infra.applyAddRoad(a, b)) {
+                    continue;
+                }
+                if (rng() % 5 != 0) {
+                    infra.applyAddBudget(a, b, unit(rng) * 100.0);
+                }
+                if (rng() % 3 == 0) {
+                    infra.applySetLength(a, b, static_cast<float>(1.0 + unit(rng) * 80.0));
                 }
-                
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                
-                infra.searchCity(index);
-                cout << "\nPress Enter to continue..." << endl;
-                cin.get();
-                break;
             }
-            
-            case 6:
-                printDivider('=', 60);
-                printTitle("DISPLAY CITIES", '=', 60);
-                printDivider('-', 60);
-                infra.displayCities();
-                cout << "\nPress Enter to continue..." << endl;
-                cin.get();
-                break;
-                
-            case 7:
-                printDivider('=', 60);
-                printTitle("DISPLAY ROADS", '=', 60);
-                printDivider('-', 60);
-                infra.displayRoads();
-                cout << "\nPress Enter to continue..." << endl;
-                cin.get();
+        }
+    }
+
+    // True when the slots follow existing roads whose budgets add up to cost
+    static bool followsRoads(const InfrastructureManagement& infra, const vector<int>& slots, double cost) {
+        double total = 0.0;
+        for (size_t i = 1; i < slots.size(); i++) {
+            if (!infra.roads.hasRoad(slots[i - 1], slots[i])) {
+                return false;
+            }
+            total += infra.roads.getBudget(slots[i - 1], slots[i]);
+        }
+        return sameCost(total, cost);
+    }
+
+    // Compares the session's cheapest routes with a plain Dijkstra search
+    void compareRoutes(InfrastructureManagement& infra, mt19937_64& rng, const string& what) {
+        uniform_int_distribution<int> pick(0, checkedCast<int>(infra.cities.size()) - 1);
+        RoutePlanner dijkstra;
+        vector<int> path;
+        size_t differ = 0, broken = 0;
+        for (int query = 0; query < 300; query++) {
+            int source = pick(rng), target = pick(rng);
+            double expected, cost;
+            bool reachable = dijkstra.findRoute(infra.roads, infra.ensureGeometry(), RouteMetric::Budget, source, target,
+                                                path, expected);
+            bool found = infra.planRoute(RouteMetric::Budget, source, target, cost);
+            if (found != reachable || (found && !sameCost(cost, expected))) {
+                differ++;
+            } else if (found && !followsRoads(infra, infra.routeSlots, cost)) {
+                broken++;
+            }
+        }
+        expect(differ == 0, what + ": " + to_string(differ) + " of 300 route costs differ from Dijkstra's");
+        expect(broken == 0, what + ": " + to_string(broken) + " routes do not follow roads adding up to their cost");
+    }
+
+    // Changes made through the menu reach the next session through the
+    // journal alone; an entry cut off while being written is dropped rather
+    // than joined to the next one
+    void journalReplay() {
+        Contents written;
+        {
+            InfrastructureManagement infra;
+            infra.addCities(vector<string>{"Kigali", "Huye", "Musanze", "Rubavu"});
+            infra.addRoad("Kigali", "Huye");
+            infra.addRoad("Kigali", "Musanze");
+            infra.addRoad("Huye", "Rubavu");
+            infra.addBudget("Kigali", "Huye", 0.1 + 0.2);
+            infra.setRoadLength("Kigali", "Musanze", 86.5);
+            infra.setCityRegion("Huye", "Southern");
+            infra.deleteCity("Rubavu");  // The highest index, which must not be handed out again
+            expect(!infra.applyBatchCommand("road\tKigali\tHuye").empty(), "a batch road that already exists fails");
+            expect(!infra.checkNewCity("Nya\tmata").empty() && !infra.checkNewCity("Nya\nmata").empty(),
+                   "city names with tabs or line breaks are refused");
+            written = contentsOf(infra);
+        }
+        expect(written.cities.size() == 3 && written.roads.size() == 2 && written.highestIndex == 4,
+               "the session holds the changes made");
+
+        uintmax_t complete = filesystem::file_size("journal.log");
+        {
+            ofstream journal("journal.log", ios::app);
+            journal << "BUDGET\t1\t3\t7";  // No newline: cut off
+        }
+        {
+            InfrastructureManagement infra;
+            expect(contentsOf(infra) == written, "the journal replays every change");
+            expect(filesystem::file_size("journal.log") == complete, "the incomplete last entry is truncated");
+            infra.addBudget("Kigali", "Musanze", 12.5);
+            written = contentsOf(infra);
+        }
+        {
+            InfrastructureManagement infra;
+            expect(contentsOf(infra) == written, "an entry journaled after the truncation replays");
+
+            // A failed save keeps the journal, which still holds the changes
+            filesystem::create_directory("cities.txt.tmp");
+            expect(!infra.saveAllData(), "a save fails when cities.txt cannot be written");
+            expect(filesystem::file_size("journal.log") > 0, "the journal is kept after a failed save");
+            filesystem::remove("cities.txt.tmp");
+            expect(infra.saveAllData(), "the save succeeds once cities.txt can be written");
+            expect(filesystem::file_size("journal.log") == 0, "the journal is emptied by a save");
+        }
+        InfrastructureManagement infra;
+        expect(contentsOf(infra) == written, "the saved files hold what the journal did");
+    }
+
+    // infrastructure.snap holds exactly what cities.txt and roads.txt hold;
+    // a snapshot of another version, or a damaged one, is ignored and the
+    // text files read instead
+    void snapshotRoundTrip() {
+        mt19937_64 rng(1);
+        Contents saved;
+        {
+            InfrastructureManagement infra;
+            populate(infra, 300, 5, rng);
+            for (int slot : {299, 150, 10}) {
+                infra.applyDeleteCity(slot);
+            }
+            saved = contentsOf(infra);
+            expect(infra.saveAllData(), "the data is saved");
+        }
+        {
+            InfrastructureManagement infra;
+            expect(infra.loadSnapshot(), "the snapshot is valid");
+            expect(contentsOf(infra) == saved, "the snapshot keeps every city, road and the highest index");
+        }
+
+        filesystem::rename("infrastructure.snap", "saved.snap");
+        {
+            InfrastructureManagement infra;
+            expect(contentsOf(infra) == saved, "the text files keep every city, road and the highest index");
+        }
+
+        string bytes = readFile("saved.snap");
+        for (uint32_t version : {SNAPSHOT_VERSION - 1, SNAPSHOT_VERSION + 1}) {
+            string changed = bytes;
+            memcpy(changed.data() + offsetof(SnapshotHeader, version), &version, sizeof(version));
+            writeFile("infrastructure.snap", changed);
+            InfrastructureManagement infra;
+            expect(!infra.loadSnapshot(), "a version " + to_string(version) + " snapshot is rejected");
+            expect(contentsOf(infra) == saved, "the text files are read instead of a version " + to_string(version) + " snapshot");
+        }
+        writeFile("infrastructure.snap", bytes.substr(0, bytes.size() - sizeof(Road)));
+        InfrastructureManagement infra;
+        expect(!infra.loadSnapshot(), "a truncated snapshot is rejected");
+        expect(contentsOf(infra) == saved, "the text files are read instead of a truncated snapshot");
+    }
+
+    // Routes over the contraction hierarchy cost what Dijkstra's cost, on
+    // each kind of generated network, before and after roads.ch is reloaded
+    void hierarchyMatchesDijkstra() {
+        for (const char* kind : {"grid", "geometric", "scalefree"}) {
+            SyntheticNetwork network(kind, 3000, 7);
+            network.writeFiles();
+            remove("infrastructure.snap");
+            remove("roads.ch");
+            mt19937_64 rng(11);
+            {
+                InfrastructureManagement infra;
+                // Roads without a budget are free to use, and one city has no road
+                uniform_int_distribution<int> pick(0, checkedCast<int>(infra.cities.size()) - 1);
+                for (int road = 0; road < 30; road++) {
+                    int a = pick(rng), b = pick(rng);
+                    if (a != b) {
+                        infra.applyAddRoad(a, b);
+                    }
+                }
+                infra.applyAddCity("Island", infra.nextCityIndex());
+                expect(infra.saveAllData(), string(kind) + ": the network is saved");
+                infra.buildHierarchy();
+                compareRoutes(infra, rng, kind);
+            }
+            InfrastructureManagement infra;
+            expect(infra.hierarchy != nullptr, string(kind) + ": roads.ch is loaded by the next session");
+            compareRoutes(infra, rng, string(kind) + " reloaded");
+        }
+    }
+
+    // Cached routes stay right while roads are added, budgets changed and
+    // roads and cities deleted, each through the menu and journal
+    void routeCacheInvalidation() {
+        SyntheticNetwork network("grid", 400, 3);
+        network.writeFiles();
+        const vector<string>& names = network.getNames();
+        InfrastructureManagement infra;
+        mt19937_64 rng(5);
+        uniform_int_distribution<size_t> pick(0, names.size() - 1);
+        uniform_real_distribution<double> amount(1.0, 100.0);
+
+        // The same questions are asked after every change
+        vector<pair<string, string>> asked;
+        for (int i = 0; i < 40; i++) {
+            asked.push_back({names[pick(rng)], names[pick(rng)]});
+        }
+
+        RoutePlanner dijkstra;
+        vector<int> path, expectedPath;
+        size_t differ = 0;
+        for (int step = 0; step < 400; step++) {
+            const string& city = names[pick(rng)];
+            int idx = infra.findCityIndexByName(city);
+            string neighbor;
+            if (idx != -1 && !infra.roads.neighbors(idx).empty()) {
+                const vector<Road>& list = infra.roads.neighbors(idx);
+                neighbor = string(infra.cities[list[rng() % list.size()].neighbor].getName());
+            }
+            switch (rng() % 8) {
+            case 0:
+            case 1:
+                infra.addRoad(city, names[pick(rng)]);
                 break;
-                
-            case 8:
-                printDivider('=', 60);
-                printTitle("DISPLAY ALL DATA", '=', 60);
-                printDivider('-', 60);
-                infra.displayAllData();
-                cout << "\nPress Enter to continue..." << endl;
-                cin.get();
+            case 2:
+            case 3:
+            case 4:
+                if (!neighbor.empty()) {
+                    infra.addBudget(city, neighbor, amount(rng));
+                }
                 break;
-                
-            case 9:
-                printDivider('=', 60);
-                printTitle("EXITING PROGRAM", '=', 60);
-                printDivider('-', 60);
-                cout << "Exiting program. Goodbye!" << endl;
-                // Save all data before exiting
-                infra.saveAllData();
+            case 5:
+            case 6:
+                if (!neighbor.empty()) {
+                    infra.deleteRoad(city, neighbor);
+                }
                 break;
-                
             default:
-                cout << "Invalid choice. Please try again." << endl;
+                if (idx != -1) {
+                    infra.deleteCity(city);
+                }
+                break;
+            }
+
+            for (const auto& [from, to] : asked) {
+                double cost, expected;
+                bool found = infra.getCheapestRoute(from, to, path, cost);
+                int source = infra.findCityIndexByName(from);
+                int target = infra.findCityIndexByName(to);
+                bool reachable = source != -1 && target != -1 &&
+                                 dijkstra.findRoute(infra.roads, infra.ensureGeometry(), RouteMetric::Budget, source,
+                                                    target, expectedPath, expected);
+                if (found != reachable || (found && !sameCost(cost, expected))) {
+                    differ++;
+                }
+            }
         }
-        
-    } while (choice != 9);
-    
-    return 0;
+        expect(differ == 0, to_string(differ) + " answers differ from a fresh Dijkstra search");
+        expect(infra.routeCache.getHits() > 0, "repeated questions are answered from the cache");
+    }
+
+    // Deleted cities leave tombstones that are squeezed out later; lookups
+    // and roads stay right throughout, and deleted indices are never reused
+    void tombstoneCompaction() {
+        mt19937_64 rng(2);
+        InfrastructureManagement infra;
+        populate(infra, 400, 1, rng);
+        map<int, string> live;  // Public index -> name
+        for (const City& city : infra.cities) {
+            live[city.getIndex()] = string(city.getName());
+        }
+        set<int> deleted;
+        size_t wrongLookups = 0, wrongRoads = 0, reused = 0;
+        for (int round = 0; round < 300; round++) {
+            uniform_int_distribution<size_t> pick(0, infra.cities.size() - 1);
+            size_t slot = pick(rng);
+            if (!infra.cities[slot].isDeleted()) {
+                int index = infra.cities[slot].getIndex();
+                infra.applyDeleteCity(checkedCast<int>(slot));
+                live.erase(index);
+                deleted.insert(index);
+            }
+            if (rng() % 3 == 0) {
+                int index = infra.nextCityIndex();
+                reused += deleted.count(index);
+                infra.applyAddCity("New " + to_string(index), index);
+                live[index] = "New " + to_string(index);
+            }
+
+            for (const auto& [index, name] : live) {
+                int found = infra.findCityIndexByIndex(index);
+                if (found == -1 || infra.findCityIndexByName(name) != found || infra.cities[found].getName() != name) {
+                    wrongLookups++;
+                }
+            }
+            for (int index : deleted) {
+                wrongLookups += infra.findCityIndexByIndex(index) != -1;
+            }
+            for (size_t i = 0; i < infra.cities.size(); i++) {
+                for (const Road& road : infra.roads.neighbors(i)) {
+                    if (infra.cities[i].isDeleted() || infra.cities[road.neighbor].isDeleted() ||
+                        !infra.roads.hasRoad(road.neighbor, checkedCast<int>(i))) {
+                        wrongRoads++;
+                    }
+                }
+            }
+            if (infra.cities.size() != live.size() + infra.deadCities) {
+                wrongLookups++;
+            }
+        }
+        expect(wrongLookups == 0, to_string(wrongLookups) + " lookups by name or index went wrong");
+        expect(wrongRoads == 0, to_string(wrongRoads) + " roads touch a deleted city or are listed from one end");
+        expect(reused == 0, "deleted indices are not handed out again");
+        expect(infra.cities.size() < 400 + deleted.size(), "tombstones are compacted once there are enough of them");
+
+        int highest = live.rbegin()->first;
+        infra.applyDeleteCity(infra.findCityIndexByIndex(highest));
+        Contents before = contentsOf(infra);
+        expect(infra.deadCities == 0 && infra.cities.size() == live.size() - 1, "compaction drops every tombstone");
+        expect(infra.saveAllData(), "the data is saved");
+        remove("infrastructure.snap");
+
+        InfrastructureManagement reloaded;
+        expect(contentsOf(reloaded) == before, "the compacted data reloads from the text files");
+        expect(reloaded.nextCityIndex() == highest + 1, "the index of the deleted highest city is not reused");
+    }
+
+    // Stored by region, a session loads only the regions it works in and
+    // sees the same network as one that loads everything
+    void lazyRegionLoading() {
+        mt19937_64 rng(3);
+        vector<string> town(4);  // A city in each region
+        double total = 0.0, cost = 0.0;
+        bool found;
+        vector<int> path;
+        Contents whole;
+        {
+            InfrastructureManagement infra;
+            populate(infra, 200, 4, rng);
+            // Regions 0 and 1 are joined by one road; 2 and 3 stand alone
+            infra.applyAddRoad(0, 1);
+            infra.applyAddBudget(0, 1, 4.5);
+            for (size_t region = 0; region < town.size(); region++) {
+                town[region] = string(infra.cities[40 + region].getName());
+            }
+            infra.getCityBudgetTotal(town[2], total);
+            found = infra.getCheapestRoute(town[0], town[1], path, cost);
+            whole = contentsOf(infra);
+            infra.storeByRegion();
+        }
+        expect(found, "the road between regions 0 and 1 joins them");
+
+        InfrastructureManagement lazy;
+        expect(lazy.sharded && lazy.cities.empty(), "nothing is loaded at the start");
+        double lazyTotal = 0.0, lazyCost = 0.0;
+        expect(lazy.getCityBudgetTotal(town[2], lazyTotal) && sameCost(lazyTotal, total),
+               "a city's budget total matches");
+        expect(loadedRegions(lazy) == vector<string>{"Region 2"}, "only the city's own region is loaded");
+        expect(lazy.getCheapestRoute(town[0], town[1], path, lazyCost) && sameCost(lazyCost, cost),
+               "a route across two regions matches");
+        expect(loadedRegions(lazy) == vector<string>{"Region 0", "Region 1", "Region 2"},
+               "only the regions the route can reach are loaded");
+
+        // A change made while most regions are still on disk is saved with them
+        lazy.addRoad(town[2], town[3]);
+        lazy.addBudget(town[2], town[3], 9.25);
+        expect(lazy.saveAllData(), "the regions are saved");
+        Contents edited = contentsOf(lazy);
+        expect(edited.cities == whole.cities && edited.roads.size() == whole.roads.size() + 1,
+               "the session holds the whole network and the new road");
+        InfrastructureManagement reopened;
+        expect(contentsOf(reopened) == edited, "every region reloads with the change");
+    }
+
+    // Counts the cities reached from start without using the closed city or
+    // the closed road, marking them in seen
+    static int reach(const RoadGraph& graph, int start, int closedCity, pair<int, int> closedRoad, vector<char>& seen) {
+        vector<int> stack = {start};
+        seen[start] = 1;
+        int count = 0;
+        while (!stack.empty()) {
+            int v = stack.back();
+            stack.pop_back();
+            count++;
+            for (const Road& road : graph.neighbors(v)) {
+                int w = road.neighbor;
+                if (w == closedCity || seen[w] || pair<int, int>(min(v, w), max(v, w)) == closedRoad) {
+                    continue;
+                }
+                seen[w] = 1;
+                stack.push_back(w);
+            }
+        }
+        return count;
+    }
+
+    // Tarjan's critical roads and cities match closing each road and each
+    // city in turn and counting what is cut off
+    void criticalMatchesBruteForce() {
+        size_t wrong = 0;
+        for (uint64_t seed = 1; seed <= 300; seed++) {
+            mt19937_64 rng(seed);
+            int n = checkedCast<int>(1 + rng() % 30);
+            uniform_int_distribution<int> pick(0, n - 1);
+            RoadGraph graph;
+            graph.resize(n);
+            for (int road = checkedCast<int>(rng() % (2 * n + 1)); road > 0; road--) {
+                int a = pick(rng), b = pick(rng);
+                if (a != b && graph.addRoad(a, b)) {
+                    graph.setBudget(a, b, static_cast<double>(rng() % 10));
+                }
+            }
+            CriticalInfrastructure analysis;
+            analysis.compute(graph);
+
+            map<pair<int, int>, int> roads;
+            map<int, pair<double, int>> cities;
+            for (int v = 0; v < n; v++) {
+                vector<int> pieces;
+                vector<char> seen(n, 0);
+                seen[v] = 1;
+                double budget = 0.0;
+                for (const Road& road : graph.neighbors(v)) {
+                    budget += road.budget;
+                    if (!seen[road.neighbor]) {
+                        pieces.push_back(reach(graph, road.neighbor, v, {-1, -1}, seen));
+                    }
+                    if (v < road.neighbor) {
+                        vector<char> side(n, 0);
+                        int near = reach(graph, v, -1, {v, road.neighbor}, side);
+                        if (!side[road.neighbor]) {
+                            roads[{v, road.neighbor}] = min(near, reach(graph, road.neighbor, -1, {v, road.neighbor}, side));
+                        }
+                    }
+                }
+                if (pieces.size() >= 2) {
+                    int sum = accumulate(pieces.begin(), pieces.end(), 0);
+                    cities[v] = {budget, sum - *max_element(pieces.begin(), pieces.end())};
+                }
+            }
+
+            map<pair<int, int>, int> foundRoads;
+            for (const auto& road : analysis.getRoads()) {
+                foundRoads[{min(road.city1, road.city2), max(road.city1, road.city2)}] = road.citiesCutOff;
+                wrong += road.budget != graph.getBudget(road.city1, road.city2);
+            }
+            map<int, pair<double, int>> foundCities;
+            for (const auto& city : analysis.getCities()) {
+                foundCities[city.city] = {city.budget, city.citiesCutOff};
+            }
+            wrong += (foundRoads != roads) + (foundCities != cities);
+        }
+        expect(wrong == 0, to_string(wrong) + " of 300 random networks disagree with the brute-force search");
+
+        // A long chain: every road is critical, and the search must not recurse
+        const int chain = 200000;
+        RoadGraph graph;
+        graph.resize(chain);
+        vector<RoadEdge> edges;
+        for (int i = 0; i + 1 < chain; i++) {
+            edges.push_back(RoadEdge{i, i + 1, 1.0});
+        }
+        graph.addRoads(edges);
+        CriticalInfrastructure analysis;
+        analysis.compute(graph);
+        expect(analysis.getRoads().size() == chain - 1 && analysis.getCities().size() == chain - 2,
+               "every road and inner city of a chain is critical");
+    }
+
+    template <typename Body>
+    void run(const string& name, Body body) {
+        filesystem::path start = filesystem::current_path();
+        filesystem::path scratch = filesystem::temp_directory_path() /
+                                   ("infrastructure-test-" + to_string(getpid()) + "-" + name);
+        filesystem::remove_all(scratch);
+        filesystem::create_directories(scratch);
+        filesystem::current_path(scratch);
+
+        test = name;
+        size_t failedBefore = failures.size();
+        auto began = chrono::steady_clock::now();
+        streambuf* console = cout.rdbuf(&nullBuffer);
+        body();
+        cout.rdbuf(console);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - began).count();
+
+        filesystem::current_path(start);
+        filesystem::remove_all(scratch);
+        cout << (failures.size() == failedBefore ? "  ok    " : "  FAIL  ") << left << setw(28) << name << right
+             << fixed << setprecision(2) << seconds << " s" << endl;
+    }
+
+public:
+    SelfTest() : checks(0) {}
+
+    // Returns the number of failed expectations
+    size_t runAll() {
+        run("journal", [&] { journalReplay(); });
+        run("snapshot", [&] { snapshotRoundTrip(); });
+        run("hierarchy", [&] { hierarchyMatchesDijkstra(); });
+        run("route-cache", [&] { routeCacheInvalidation(); });
+        run("tombstones", [&] { tombstoneCompaction(); });
+        run("regions", [&] { lazyRegionLoading(); });
+        run("critical", [&] { criticalMatchesBruteForce(); });
+
+        for (const string& failure : failures) {
+            cout << "FAILED " << failure << endl;
+        }
+        cout << checks << " checks, " << failures.size() << " failed" << endl;
+        return failures.size();
+    }
+};
+
+int main() {
+    SelfTest tests;
+    return tests.runAll() == 0 ? 0 : 1;
 }
+
+#endif // INFRA_TEST